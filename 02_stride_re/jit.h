@@ -0,0 +1,171 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "uarch.h"
+
+// tiny code emitter for training sequences.
+// Instead of calling a copied `mov (%rdi), %al; ret` gadget once per access from a C loop, jit_emit generates a whole
+// training routine: a loop whose single load instruction sits exactly at descriptor->load_address, followed by the
+// fence / nops / reset requested by the descriptor, stepping through `accesses` addresses `stride` bytes apart.
+// The routine is called once per training round with the first address as argument.
+//
+// the loop setup is placed directly in front of the load, so the bytes before load_address (up to JIT_PROLOGUE_SIZE)
+// and the loop after it must be mappable.
+
+struct jit_descriptor {
+    // PC of the (only) training load
+    uintptr_t load_address;
+    // number of loads per call
+    int accesses;
+    // distance between two loads in bytes (may be negative)
+    int64_t stride;
+    // fence after every load
+    int fence;
+    // nops after every load
+    int nops;
+    // flush the loaded line after every load (resets the cache state the load created)
+    int reset;
+};
+
+typedef void (*jit_training_f)(void* first_address);
+
+struct jit_routine {
+    jit_training_f call;
+    uint8_t* mapping;
+    uint64_t size;
+};
+
+#define JIT_MAX_NOPS 1024
+
+#ifdef __x86_64__
+    // mov rax, rdi; movabs rdx, stride; mov ecx, accesses
+    #define JIT_PROLOGUE_SIZE (3 + 10 + 5)
+    // load, mfence, nops, clflush, add, dec, jnz rel32, ret
+    #define JIT_MAX_BODY_SIZE (4 + 3 + JIT_MAX_NOPS + 3 + 3 + 2 + 6 + 1)
+#elif defined (__aarch64__)
+    // mov x9, x0; 4x movz/movk x10, stride; movz w11, accesses
+    #define JIT_PROLOGUE_SIZE (6 * 4)
+    // ldrb, dsb, isb, nops, dc civac, add, subs, b.ne, ret
+    #define JIT_MAX_BODY_SIZE ((6 + JIT_MAX_NOPS + 2) * 4)
+#endif
+
+#ifdef __x86_64__
+
+static uint8_t* jit_bytes(uint8_t* code, const void* bytes, uint64_t size) {
+    memcpy(code, bytes, size);
+    return code + size;
+}
+
+static uint8_t* jit_prologue(uint8_t* code, const struct jit_descriptor* descriptor) {
+    code = jit_bytes(code, "\x48\x89\xf8", 3);              // mov rax, rdi
+    code = jit_bytes(code, "\x48\xba", 2);                  // movabs rdx, stride
+    code = jit_bytes(code, &descriptor->stride, 8);
+    code = jit_bytes(code, "\xb9", 1);                      // mov ecx, accesses
+    uint32_t accesses = descriptor->accesses;
+    return jit_bytes(code, &accesses, 4);
+}
+
+static uint8_t* jit_body(uint8_t* code, const struct jit_descriptor* descriptor) {
+    uint8_t* loop = code;
+    code = jit_bytes(code, "\x0f\xb6\x30", 3);              // movzx esi, byte ptr [rax]
+    if(descriptor->fence) {
+        code = jit_bytes(code, "\x0f\xae\xf0", 3);          // mfence
+    }
+    memset(code, 0x90, descriptor->nops);                   // nop
+    code += descriptor->nops;
+    if(descriptor->reset) {
+        code = jit_bytes(code, "\x0f\xae\x38", 3);          // clflush [rax]
+    }
+    code = jit_bytes(code, "\x48\x01\xd0", 3);              // add rax, rdx
+    code = jit_bytes(code, "\xff\xc9", 2);                  // dec ecx
+    code = jit_bytes(code, "\x0f\x85", 2);                  // jnz loop
+    int32_t offset = loop - (code + 4);
+    code = jit_bytes(code, &offset, 4);
+    return jit_bytes(code, "\xc3", 1);                      // ret
+}
+
+#elif defined (__aarch64__)
+
+static uint8_t* jit_instruction(uint8_t* code, uint32_t instruction) {
+    memcpy(code, &instruction, 4);
+    return code + 4;
+}
+
+static uint8_t* jit_prologue(uint8_t* code, const struct jit_descriptor* descriptor) {
+    uint64_t stride = descriptor->stride;
+    code = jit_instruction(code, 0xaa0003e9);               // mov x9, x0
+    code = jit_instruction(code, 0xd280000a | ((stride & 0xffff) << 5));                // movz x10, #stride[15:0]
+    for(int shift = 1; shift < 4; shift++) {                                            // movk x10, #stride[..], lsl #16 * shift
+        code = jit_instruction(code, 0xf280000a | (shift << 21) | (((stride >> (16 * shift)) & 0xffff) << 5));
+    }
+    return jit_instruction(code, 0x5280000b | ((descriptor->accesses & 0xffff) << 5));  // movz w11, #accesses
+}
+
+static uint8_t* jit_body(uint8_t* code, const struct jit_descriptor* descriptor) {
+    uint8_t* loop = code;
+    code = jit_instruction(code, 0x3940012c);               // ldrb w12, [x9]
+    if(descriptor->fence) {
+        code = jit_instruction(code, 0xd5033f9f);           // dsb sy
+        code = jit_instruction(code, 0xd5033fdf);           // isb
+    }
+    for(int i = 0; i < descriptor->nops; i++) {
+        code = jit_instruction(code, 0xd503201f);           // nop
+    }
+    if(descriptor->reset) {
+        code = jit_instruction(code, 0xd50b7e29);           // dc civac, x9
+    }
+    code = jit_instruction(code, 0x8b0a0129);               // add x9, x9, x10
+    code = jit_instruction(code, 0x7100056b);               // subs w11, w11, #1
+    int32_t offset = (loop - code) / 4;
+    code = jit_instruction(code, 0x54000001 | ((offset & 0x7ffff) << 5));               // b.ne loop
+    return jit_instruction(code, 0xd65f03c0);               // ret
+}
+
+#endif /* ARCHITECTURE */
+
+// emits the training routine described by descriptor, returns -1 if it cannot be placed at the requested address
+static int jit_emit(struct jit_routine* routine, const struct jit_descriptor* descriptor) {
+    if(descriptor->accesses < 1 || descriptor->nops < 0 || descriptor->nops > JIT_MAX_NOPS) {
+        return -1;
+    }
+    #ifdef __aarch64__
+    if(descriptor->load_address % 4 || descriptor->accesses > 0xffff) {
+        return -1;
+    }
+    #endif /* __aarch64__ */
+
+    uintptr_t entry = descriptor->load_address - JIT_PROLOGUE_SIZE;
+    uintptr_t start = entry - (entry % PAGE_SIZE);
+    uintptr_t end = descriptor->load_address + JIT_MAX_BODY_SIZE;
+    routine->size = (end - start + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+
+    routine->mapping = mmap((void*) start, routine->size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE | MAP_FIXED_NOREPLACE, -1, 0);
+    if(routine->mapping == MAP_FAILED || routine->mapping != (void*) start) {
+        if(routine->mapping != MAP_FAILED) {
+            munmap(routine->mapping, routine->size);
+        }
+        routine->mapping = NULL;
+        return -1;
+    }
+
+    uint8_t* code = jit_prologue((uint8_t*) entry, descriptor);
+    code = jit_body(code, descriptor);
+    __builtin___clear_cache((char*) entry, (char*) code);
+
+    mprotect(routine->mapping, routine->size, PROT_READ | PROT_EXEC);
+    routine->call = (jit_training_f)(void*) entry;
+    return 0;
+}
+
+static void jit_release(struct jit_routine* routine) {
+    if(routine->mapping) {
+        munmap(routine->mapping, routine->size);
+        routine->mapping = NULL;
+    }
+}
+
+#endif /* JIT_H */
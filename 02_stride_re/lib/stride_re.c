@@ -0,0 +1,286 @@
+// the worker stays on the core passed to sr_init
+#define ENV_FIXED_CORE
+
+#include "tests/common.h"
+#include "tests/trial.h"
+
+#include <pthread.h>
+
+#include "lib/stride_re.h"
+
+#define SR_API __attribute__((visibility("default")))
+
+#define MAX(a, b) (a > b ? a : b)
+
+#ifdef ACCESS_MEMORY
+    #ifndef DUMMY_BUFFER_SIZE
+        #define DUMMY_BUFFER_SIZE (PAGE_SIZE * 10)
+    #endif /* DUMMY_BUFFER_SIZE */
+    static uint8_t* dummy_buffer;
+#endif /* ACCESS_MEMORY */
+
+enum sr_command {
+    SR_CMD_NONE,
+    SR_CMD_INIT,
+    SR_CMD_RUN,
+    SR_CMD_EXIT
+};
+
+// state shared between the caller and the worker. A command is handed over under the lock and the caller waits
+// until the worker reset it to SR_CMD_NONE.
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int started;
+    int initialized;
+    int core;
+
+    enum sr_command command;
+    int64_t result;
+
+    struct sr_variant variant;
+    int configured;
+    uint64_t trials;
+    uint64_t* times;
+    uint8_t* hits;
+
+    struct trial_tracker tracker;
+} sr = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+// same trial as test_prefetch_simple
+static uint64_t sr_trial(const struct sr_variant* variant) {
+
+    uint64_t trace = trace_begin();
+    victim_flush_buffer();
+    trace_end(TRACE_FLUSH, trace);
+
+    #ifdef ACCESS_MEMORY
+        for(uint64_t i = 0; i < DUMMY_BUFFER_SIZE; i += 64) maccess(&dummy_buffer[i]);
+    #endif /* ACCESS_MEMORY */
+
+    #ifdef USE_NOP
+        for(int i = 0; i < NOP_COUNT; i++) nop();
+    #endif /* USE_NOP */
+
+    int repeats = variant->repeats ? variant->repeats : PREFETCH_REPEATS;
+    trace = trace_rounds_begin();
+    for(int repeat = 0; repeat < repeats; repeat ++) {
+
+        uint64_t round = trace_round_begin();
+        CORE_TRAIN(variant->accesses, access, victim_load_gadget(variant->start_offset + access * variant->stride); train_fence());
+        trace_round_end(TRACE_TRAIN, round);
+
+        round = trace_round_begin();
+        victim_load_gadget(variant->access_offset);
+        #ifdef USE_FENCE
+            mfence();
+        #endif /* USE_FENCE */
+        trace_round_end(TRACE_TRIGGER, round);
+    }
+    trace_rounds_end(trace);
+
+    trace = trace_begin();
+    uint64_t time = victim_probe(variant->measure_offset);
+    trace_end(TRACE_PROBE, trace);
+    return time;
+}
+
+static int64_t sr_worker_init(void) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(sr.core, &cpuset);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset)) {
+        ERROR("failed to pin worker to core %d\n", sr.core);
+        return -1;
+    }
+    // the scheduling policy applies to the worker thread only, mlockall locks the whole process (the interpreter too)
+    env_setup();
+
+    #ifdef ACCESS_MEMORY
+        dummy_buffer = mmap(NULL, DUMMY_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if(dummy_buffer == MAP_FAILED) {
+            ERROR("failed to map memory to access!\n");
+            return -1;
+        }
+    #endif /* ACCESS_MEMORY */
+
+    if(time_init()) {
+        ERROR("failed to initialize timer!\n");
+        return -1;
+    }
+    if(victim_init()) {
+        ERROR("failed to initialize victim!\n");
+        time_destroy();
+        return -1;
+    }
+
+    if(trial_init(&sr.tracker, calculate_threshold())) {
+        ERROR("failed to initialize trials!\n");
+        victim_destroy();
+        time_destroy();
+        return -1;
+    }
+    return 0;
+}
+
+static int64_t sr_worker_run(void) {
+    // like trial_runs, but keeps the time and the classification of every trial
+    int64_t hits = 0;
+    for(uint64_t done = 0; done < sr.trials;) {
+        uint64_t size = sr.trials - done < TRIAL_BATCH ? sr.trials - done : TRIAL_BATCH;
+        int64_t batch_hits;
+        do {
+            trial_batch_begin(&sr.tracker);
+            batch_hits = 0;
+            for(uint64_t trial = done; trial < done + size; trial ++) {
+                uint64_t time;
+                do {
+                    trial_begin(&sr.tracker);
+                    time = sr_trial(&sr.variant);
+                } while(trial_reject(&sr.tracker));
+                int hit = trial_hit(&sr.tracker, time);
+
+                if(sr.times) {
+                    sr.times[trial] = time;
+                }
+                if(sr.hits) {
+                    sr.hits[trial] = hit;
+                }
+                batch_hits += hit;
+            }
+        } while(trial_batch_reject(&sr.tracker));
+        hits += batch_hits;
+        done += size;
+    }
+    return hits;
+}
+
+static void* sr_worker(void* argument) {
+    (void) argument;
+    pthread_mutex_lock(&sr.lock);
+    for(;;) {
+        while(sr.command == SR_CMD_NONE) {
+            pthread_cond_wait(&sr.cond, &sr.lock);
+        }
+        enum sr_command command = sr.command;
+        // the caller waits for the result, so nobody touches the shared state while the lock is dropped
+        pthread_mutex_unlock(&sr.lock);
+
+        int64_t result = 0;
+        switch(command) {
+            case SR_CMD_INIT:
+                result = sr_worker_init();
+                break;
+            case SR_CMD_RUN:
+                result = sr_worker_run();
+                break;
+            case SR_CMD_EXIT:
+                victim_destroy();
+                time_destroy();
+                if(sr.tracker.perf_fd >= 0) {
+                    close(sr.tracker.perf_fd);
+                }
+                break;
+            default:
+                break;
+        }
+
+        pthread_mutex_lock(&sr.lock);
+        sr.result = result;
+        sr.command = SR_CMD_NONE;
+        pthread_cond_broadcast(&sr.cond);
+        if(command == SR_CMD_EXIT || (command == SR_CMD_INIT && result)) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sr.lock);
+    return NULL;
+}
+
+static int64_t sr_submit(enum sr_command command) {
+    pthread_mutex_lock(&sr.lock);
+    sr.command = command;
+    pthread_cond_broadcast(&sr.cond);
+    while(sr.command != SR_CMD_NONE) {
+        pthread_cond_wait(&sr.cond, &sr.lock);
+    }
+    int64_t result = sr.result;
+    pthread_mutex_unlock(&sr.lock);
+    return result;
+}
+
+SR_API int sr_abi_version(void) {
+    return SR_ABI_VERSION;
+}
+
+SR_API int sr_init(int core) {
+    if(sr.started) {
+        ERROR("already initialized\n");
+        return -1;
+    }
+    sr.core = core;
+    sr.command = SR_CMD_NONE;
+    if(pthread_create(&sr.thread, NULL, sr_worker, NULL)) {
+        ERROR("failed to start worker thread\n");
+        return -1;
+    }
+    sr.started = 1;
+    if(sr_submit(SR_CMD_INIT)) {
+        pthread_join(sr.thread, NULL);
+        sr.started = 0;
+        return -1;
+    }
+    sr.initialized = 1;
+    return 0;
+}
+
+SR_API int sr_configure(const struct sr_variant* variant) {
+    int64_t last = variant->start_offset + variant->stride * (variant->accesses - 1);
+    uint64_t required = MAX(MAX(variant->measure_offset, variant->access_offset), (uint64_t) MAX(last, 0)) + 8;
+    if(variant->accesses < 1 || variant->repeats < 0 || last < 0 || required > VICTIM_BUFFER_SIZE) {
+        ERROR("invalid variant (required: %zu, available: %zu)\n", required, (uint64_t) VICTIM_BUFFER_SIZE);
+        return -1;
+    }
+    sr.variant = *variant;
+    sr.configured = 1;
+    return 0;
+}
+
+SR_API int64_t sr_run(uint64_t trials, uint64_t* times, uint8_t* hits) {
+    if(!sr.initialized || !sr.configured) {
+        ERROR("sr_init and sr_configure have to be called first\n");
+        return -1;
+    }
+    sr.trials = trials;
+    sr.times = times;
+    sr.hits = hits;
+    return sr_submit(SR_CMD_RUN);
+}
+
+SR_API int sr_stats(struct sr_stats* stats) {
+    if(!sr.initialized) {
+        return -1;
+    }
+    stats->threshold = sr.tracker.threshold;
+    stats->initial_threshold = sr.tracker.initial_threshold;
+    stats->trials = sr.tracker.trials;
+    stats->unseparable = sr.tracker.unseparable;
+    stats->rejected = sr.tracker.rejected;
+    stats->rejected_batches = sr.tracker.rejected_batches;
+    stats->hit = sr.tracker.hit;
+    stats->miss = sr.tracker.miss;
+    return 0;
+}
+
+SR_API void sr_destroy(void) {
+    if(!sr.initialized) {
+        return;
+    }
+    sr_submit(SR_CMD_EXIT);
+    pthread_join(sr.thread, NULL);
+    sr.initialized = sr.started = sr.configured = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef STRIDE_RE_H
+#define STRIDE_RE_H
+
+#include <stdint.h>
+
+// C ABI of libstride_re.so, the trial engine of test_prefetch_simple as a library (see tests/lib_utils.py).
+// All measurements run on a worker thread pinned to the core passed to sr_init, the calling thread (e.g. Python)
+// only hands over commands. Timer, victim and USE_FENCE / ACCESS_MEMORY / ... are fixed at build time (make lib).
+//
+// every function returns 0 on success and -1 on failure unless stated otherwise.
+// Bump SR_ABI_VERSION on any incompatible change of the functions or structs below.
+
+#define SR_ABI_VERSION 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+// offsets are relative to the victim buffer, see test_prefetch_simple
+struct sr_variant {
+    int64_t stride;
+    int32_t accesses;
+    int32_t repeats;            // training rounds per trial, 0 for PREFETCH_REPEATS of the build
+    uint64_t start_offset;
+    uint64_t access_offset;
+    uint64_t measure_offset;
+};
+
+struct sr_stats {
+    uint64_t threshold;         // current (drift-tracked) threshold
+    uint64_t initial_threshold;
+    uint64_t trials;
+    int32_t unseparable;
+    int32_t rejected;
+    int32_t rejected_batches;   // batches repeated after an interrupt (TRIAL_GUARD_INTERRUPTS builds)
+    double hit;                 // EWMA of hit / miss canaries
+    double miss;
+};
+
+int sr_abi_version(void);
+
+// starts the worker on core and calibrates (may take a few seconds)
+int sr_init(int core);
+
+int sr_configure(const struct sr_variant* variant);
+
+// runs trials with the configured variant, times[i] gets the probe time and hits[i] the classification of trial i
+// (either may be NULL). Returns the number of hits or -1.
+int64_t sr_run(uint64_t trials, uint64_t* times, uint8_t* hits);
+
+int sr_stats(struct sr_stats* stats);
+
+void sr_destroy(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* STRIDE_RE_H */
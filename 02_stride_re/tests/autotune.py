@@ -0,0 +1,115 @@
+import itertools
+import math
+import sys
+import time
+
+import lib_utils
+import param_utils
+
+# finds the harness configuration (USE_FENCE, ACCESS_MEMORY + DUMMY_BUFFER_SIZE, USE_NOP + NOP_COUNT, PREFETCH_REPEATS)
+# that separates a prefetched from a non-prefetched cell fastest on this CPU and stores it in the CPU profile
+# (param_utils.save_profile), which plan_utils.py --profile and fingerprint.py load.
+#
+#   python3 autotune.py <CORES> <TIMER> <VICTIM>
+#
+# Every configuration is an arm. Arms are compared by successive halving: all arms get the same number of trials, the
+# better half survives and the next round doubles the trials, until one arm is left. Trials run in-process through
+# libstride_re, so arms that only differ in PREFETCH_REPEATS share a build.
+
+PAGE_SIZE = 4096
+
+if len(sys.argv) != 4:
+    print(f"usage: python3 {sys.argv[0]} <CORES> <TIMER> <VICTIM>")
+    sys.exit(1)
+
+CORES = sys.argv[1]
+TIMER = sys.argv[2]
+VICTIM = sys.argv[3]
+
+# same cell and control as fingerprint.py: a single training access can never establish a stride
+STRIDE = 512
+ACCESSES = 3
+
+FENCE = [[], ["-DUSE_FENCE"]]
+ACCESS_MEMORY = [[], ["-DACCESS_MEMORY", f"-DDUMMY_BUFFER_SIZE={10 * PAGE_SIZE}"], ["-DACCESS_MEMORY", f"-DDUMMY_BUFFER_SIZE={40 * PAGE_SIZE}"]]
+NOP = [[], ["-DUSE_NOP", "-DNOP_COUNT=1000"], ["-DUSE_NOP", "-DNOP_COUNT=100000"]]
+REPEATS = [1, 3, 5, 10]
+
+# trials per arm (for cell and control each) in the first round
+INITIAL_TRIALS = 50
+
+class Arm:
+
+    def __init__(self, flags, repeats):
+        self.flags = flags
+        self.repeats = repeats
+        self.trials = 0
+        self.hits = 0
+        self.control = 0
+        self.seconds = 0.0
+
+    def score(self):
+        """separation per unit time: the z statistic of cell vs. control grows with the square root of the trials,
+        so z / sqrt(seconds) does not depend on how long an arm was measured"""
+        if not self.trials or not self.seconds:
+            return 0.0
+        pooled = (self.hits + self.control) / (2 * self.trials)
+        if pooled in (0.0, 1.0):
+            return 0.0
+        z = (self.hits - self.control) / self.trials / math.sqrt(pooled * (1 - pooled) * 2 / self.trials)
+        return z / math.sqrt(self.seconds)
+
+    # tuned flags only, sweeps add their own (-DEVAL, VICTIM_BUFFER_SIZE, ...)
+    def configuration(self):
+        return self.flags + [f"-DPREFETCH_REPEATS={self.repeats}"]
+
+def measure(library, arm, trials):
+    start = time.monotonic()
+    hits, _, _ = library.run(STRIDE, ACCESSES, 0, STRIDE * ACCESSES, STRIDE * (ACCESSES + 1), trials, repeats=arm.repeats)
+    control, _, _ = library.run(STRIDE, 1, 0, STRIDE, 2 * STRIDE, trials, repeats=arm.repeats)
+    arm.seconds += time.monotonic() - start
+    arm.hits += hits
+    arm.control += control
+    arm.trials += trials
+
+start = time.time()
+BASE_FLAGS = ["-DEVAL"]
+builds = [sum(choice, []) for choice in itertools.product(FENCE, ACCESS_MEMORY, NOP)]
+arms = [Arm(flags, repeats) for flags in builds for repeats in REPEATS]
+print(f"{len(arms)} arms in {len(builds)} builds")
+
+# build every library once, later rounds only load them again
+paths = {tuple(flags): lib_utils.build(TIMER, VICTIM, BASE_FLAGS + flags, CORES) for flags in builds}
+
+trials = INITIAL_TRIALS
+while True:
+    for flags, path in paths.items():
+        group = [arm for arm in arms if tuple(arm.flags) == flags]
+        if not group:
+            continue
+        with lib_utils.StrideRE(TIMER, VICTIM, BASE_FLAGS + list(flags), CORES, path=path) as library:
+            for arm in group:
+                measure(library, arm, trials)
+
+    arms.sort(key=lambda arm: arm.score(), reverse=True)
+    print(f"{trials} trials per arm:")
+    for arm in arms:
+        print(f"  {arm.score():8.2f} {arm.hits:6} / {arm.control:6} of {arm.trials:6} in {arm.seconds:6.2f}s  {' '.join(arm.configuration())}")
+    if len(arms) == 1:
+        break
+    arms = arms[:(len(arms) + 1) // 2]
+    trials *= 2
+
+best = arms[0]
+configuration = {
+    "flags": best.configuration(),
+    "score": round(best.score(), 4),
+    "hits": best.hits,
+    "control": best.control,
+    "trials": best.trials,
+    "cell": [STRIDE, ACCESSES],
+    "arms": len(builds) * len(REPEATS),
+    "duration": round(time.time() - start, 2),
+}
+param_utils.save_profile(TIMER, VICTIM, configuration)
+print(f"best: {' '.join(best.configuration())} (saved to {param_utils.PROFILE})")
@@ -0,0 +1,122 @@
+#include "common.h"
+
+#include <sys/ioctl.h>
+
+// the MEASURE_US round-trip of the collide_power runner module is benchmarked if its device exists
+#include "../../06_collide_power/runner/module/interface.h"
+
+#ifndef BENCH_RUNNER_DEVICE
+    #define BENCH_RUNNER_DEVICE "/dev/runner"
+#endif /* BENCH_RUNNER_DEVICE */
+
+// samples per benchmark, every sample times a batch of operations
+#ifndef BENCH_SAMPLES
+    #define BENCH_SAMPLES 201
+#endif /* BENCH_SAMPLES */
+
+// micro-benchmarks of the hot-path primitives with the compiled-in timer and victim.
+// Every benchmark prints one result line:
+//   R <name> <median ns> <p90 ns> <interquartile range ns> <median timer ticks>
+// per operation. Nanoseconds come from CLOCK_MONOTONIC_RAW, so different timer backends are comparable.
+// bench.py collects the lines into a baseline and compares against it.
+
+#define BENCH_GADGET_ADDRESS 0x13370000ull
+
+struct bench_sample {
+    double ns;
+    double ticks;
+};
+
+static uint64_t bench_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static int bench_compare(const void* a, const void* b) {
+    double difference = *(const double*) a - *(const double*) b;
+    return (difference > 0) - (difference < 0);
+}
+
+static void bench_report(const char* name, double* ns, double* ticks, int samples) {
+    qsort(ns, samples, sizeof(double), bench_compare);
+    qsort(ticks, samples, sizeof(double), bench_compare);
+    RESULT("%s %.2f %.2f %.2f %.2f\n", name, ns[samples / 2], ns[samples * 9 / 10], ns[samples * 3 / 4] - ns[samples / 4], ticks[samples / 2]);
+}
+
+// times `batch` executions of the statement per sample
+#define BENCH(name, samples, batch, ...) do { \
+    static double _ns[samples], _ticks[samples]; \
+    for(int _sample = 0; _sample < (samples); _sample++) { \
+        uint64_t _start_ticks = timestamp(); \
+        uint64_t _start = bench_now_ns(); \
+        for(int _i = 0; _i < (batch); _i++) { __VA_ARGS__; } \
+        uint64_t _end = bench_now_ns(); \
+        uint64_t _end_ticks = timestamp(); \
+        _ns[_sample] = (double) (_end - _start) / (batch); \
+        _ticks[_sample] = (double) (_end_ticks - _start_ticks) / (batch); \
+    } \
+    bench_report(name, _ns, _ticks, samples); \
+} while(0)
+
+static void bench_runner(void) {
+    int fd = open(BENCH_RUNNER_DEVICE, O_RDWR);
+    if(fd < 0) {
+        INFO("%s not available, skipping MEASURE_US\n", BENCH_RUNNER_DEVICE);
+        return;
+    }
+    struct measurement_t data;
+    // 1 us measurement window, the rest is the ioctl round-trip
+    BENCH("measure_us", BENCH_SAMPLES, 10, data.cycles = 1; ioctl(fd, MEASURE_US, &data));
+    close(fd);
+}
+
+int main(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+
+    env_setup();
+
+    if(time_init()) {
+        FATAL("failed to initialize timer!\n");
+    }
+
+    if(victim_init()) {
+        FATAL("failed to initialize victim!\n");
+    }
+
+    uint64_t offset = VICTIM_BUFFER_SIZE / 2;
+    volatile uint64_t sink = 0;
+
+    warmup();
+
+    BENCH("timestamp", BENCH_SAMPLES, 1000, sink += timestamp());
+
+    victim_probe(offset);
+    BENCH("probe_hit", BENCH_SAMPLES, 100, sink += victim_probe(offset));
+    BENCH("probe_miss", BENCH_SAMPLES, 100, victim_flush_single(offset); mfence(); sink += victim_probe(offset));
+
+    BENCH("flush_single", BENCH_SAMPLES, 100, victim_flush_single(offset));
+    BENCH("flush_buffer", BENCH_SAMPLES, 10, victim_flush_buffer());
+
+    // kernel victim: CMD_GADGET ioctl, hyperthread / process victim: handshake with the victim
+    BENCH("load_gadget", BENCH_SAMPLES, 100, victim_load_gadget(offset));
+
+    BENCH("map_load_gadget", BENCH_SAMPLES / 4, 1,
+        load_gadget_f gadget = map_load_gadget(BENCH_GADGET_ADDRESS);
+        if(!gadget) {
+            FATAL("failed to map load gadget at 0x%016llx\n", BENCH_GADGET_ADDRESS);
+        }
+        munmap((void*) (BENCH_GADGET_ADDRESS - BENCH_GADGET_ADDRESS % PAGE_SIZE), 2 * PAGE_SIZE)
+    );
+
+    // the probes of the threshold and its sanity check (every miss flushes the victim buffer), without the warm-up of
+    // calculate_threshold
+    BENCH("calibration", 5, 1, sink += core_calibrate(victim_calibration_probe).threshold);
+
+    bench_runner();
+
+    victim_destroy();
+    time_destroy();
+    return 0;
+}
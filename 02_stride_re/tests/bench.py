@@ -0,0 +1,103 @@
+import json
+import os
+import param_utils
+import platform
+import run_utils
+import sys
+
+# micro-benchmarks of the measurement primitives (tests/bench.c) for every timer / victim combination.
+#
+#   python3 bench.py <CORES> <TIMERS> <VICTIMS>                     writes out/bench_<host>.json as baseline
+#   python3 bench.py <CORES> <TIMERS> <VICTIMS> <BASELINE.json>     compares against a baseline, exit code 1 on regression
+#
+# TIMERS and VICTIMS are comma separated, e.g. python3 bench.py 2 rdtsc,counter_thread userspace,kernel,hyperthread
+
+if len(sys.argv) not in [4, 5]:
+    print(f"usage: python3 {sys.argv[0]} <CORES> <TIMERS> <VICTIMS> [baseline.json]")
+    sys.exit(1)
+
+CORES = sys.argv[1]
+TIMERS = sys.argv[2].split(",")
+VICTIMS = sys.argv[3].split(",")
+BASELINE = sys.argv[4] if len(sys.argv) == 5 else None
+
+BASE_FLAGS = ["-DEVAL"]
+
+# a benchmark regressed if its median got slower by more than this fraction (and by more than the old IQR) ...
+SLOWER = 0.10
+# ... or it got noisier: its interquartile range grew by more than this fraction (and by more than 1% of the median)
+NOISIER = 0.50
+
+def machine():
+    # same CPU key as the profiles of autotune.py
+    return {"host": platform.node(), "cpu": param_utils.cpu_model(), "kernel": platform.release()}
+
+def bench(timer, victim):
+    run_utils.comp("bench", timer, victim, BASE_FLAGS, CORES, quiet=True)
+    r = run_utils.run("bench", [], cores=CORES)
+    if r.retval != 0 or not r.results:
+        print(f"{timer},{victim}: failed ({r.fatals or r.errors})")
+        return None
+    results = dict()
+    for line in r.results:
+        name, median, p90, iqr, ticks = line.split()
+        results[name] = {"median": float(median), "p90": float(p90), "iqr": float(iqr), "ticks": float(ticks)}
+    return results
+
+def compare(config, current, baseline):
+    regressions = []
+    for name, new in current.items():
+        if name not in baseline:
+            print(f"  {name:16s} {new['median']:14.2f} ns  (new)")
+            continue
+        old = baseline[name]
+        verdict = []
+        if new["median"] > old["median"] * (1 + SLOWER) and new["median"] - old["median"] > old["iqr"]:
+            verdict.append("SLOWER")
+        if new["iqr"] > old["iqr"] * (1 + NOISIER) and new["iqr"] - old["iqr"] > 0.01 * old["median"]:
+            verdict.append("NOISIER")
+        change = (new["median"] / old["median"] - 1) * 100 if old["median"] else 0
+        print(f"  {name:16s} {old['median']:14.2f} -> {new['median']:14.2f} ns ({change:+6.1f}%)  iqr {old['iqr']:.2f} -> {new['iqr']:.2f}  {' '.join(verdict)}")
+        if verdict:
+            regressions.append(f"{config} {name}: {' '.join(verdict)}")
+    return regressions
+
+results = dict()
+for timer in TIMERS:
+    for victim in VICTIMS:
+        config = f"{timer},{victim}"
+        current = bench(timer, victim)
+        if current is not None:
+            results[config] = current
+
+if BASELINE is None:
+    name = f"out/bench_{platform.node()}.json"
+    os.makedirs("out", exist_ok=True)
+    with open(name, "w") as out:
+        json.dump({"machine": machine(), "results": results}, out, indent=1)
+    for config, current in results.items():
+        print(config)
+        for bench_name, value in current.items():
+            print(f"  {bench_name:16s} {value['median']:14.2f} ns  (p90 {value['p90']:.2f}, iqr {value['iqr']:.2f}, {value['ticks']:.2f} ticks)")
+    print(f"baseline written to {name}")
+else:
+    with open(BASELINE) as f:
+        baseline = json.load(f)
+    if baseline["machine"] != machine():
+        print(f"warning: baseline is from a different machine: {baseline['machine']}")
+    regressions = []
+    for config, current in results.items():
+        print(config)
+        if config not in baseline["results"]:
+            print("  not in baseline")
+            continue
+        regressions += compare(config, current, baseline["results"][config])
+    for config in baseline["results"]:
+        if config not in results:
+            regressions.append(f"{config}: failed to run")
+    if regressions:
+        print("regressions:")
+        for regression in regressions:
+            print(f"  {regression}")
+        sys.exit(1)
+    print("no regressions")
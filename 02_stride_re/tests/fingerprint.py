@@ -0,0 +1,113 @@
+import json
+import math
+import os
+import param_utils
+import platform
+import run_utils
+import sys
+import time
+
+PAGE_SIZE = 4096
+CACHE_LINE_SIZE = 64
+
+if len(sys.argv) != 4:
+    print(f"usage: python3 {sys.argv[0]} <CORES> <TIMER> <VICTIM>")
+
+CORES = sys.argv[1]
+TIMER = sys.argv[2]
+VICTIM = sys.argv[3]
+
+# every run of a test binary performs 100 trials (test_prefetch_simple has that hard-coded)
+TRIALS = 100
+
+# a cell counts as prefetching if it beats its control with at least this confidence
+CONFIDENCE = 0.99
+
+# the fingerprint only uses a single flag combination: the tuned one of the CPU profile (autotune.py) if there is one,
+# otherwise USE_FENCE, the one that works on most CPUs we tested
+profile = param_utils.load_profile(TIMER, VICTIM)
+BASE_FLAGS = ["-DEVAL"] + (profile["flags"] if profile else ["-DUSE_FENCE"])
+
+# max stride is 1024 with max. 3 accesses, so 16KB are enough for the victim buffer
+if VICTIM == "userspace":
+    BASE_FLAGS.append("-DVICTIM_BUFFER_SIZE=0x4000")
+
+STRIDES = [256, 512, 1024]
+ACCESSES = 3
+COLLISION_BIT = 46
+
+def run_simple(stride, accesses, aligned):
+    if aligned:
+        arguments = [stride, accesses, 0, stride * accesses, stride * (accesses + 1)]
+    else:
+        arguments = [stride, accesses, 2 * stride, 0, stride]
+    r = run_utils.run("test_prefetch_simple", list(map(str, arguments)), cores=CORES)
+    return int(r.results[0]) if len(r.results) else -1
+
+def run_collision(stride, accesses, diff_bit):
+    arguments = [
+        stride, accesses, 0, stride * accesses, stride * (accesses + 1),
+        "0x7fffffffffff", f"0x{(1 << diff_bit):016x}", "0x7fffffffffff", f"0x{(1 << diff_bit):016x}",
+        TRIALS
+    ]
+    r = run_utils.run("test_prefetch_both_collisions", list(map(str, arguments)), cores=CORES)
+    return int(r.results[0]) if len(r.results) else -1
+
+def confidence(hits, control_hits, n=TRIALS):
+    """one-sided two-proportion z-test: confidence that hits / n is larger than control_hits / n"""
+    if hits < 0 or control_hits < 0:
+        return 0.0
+    pooled = (hits + control_hits) / (2 * n)
+    if pooled in (0.0, 1.0):
+        return 0.0
+    z = (hits - control_hits) / n / math.sqrt(pooled * (1 - pooled) * 2 / n)
+    return 1 - 0.5 * math.erfc(z / math.sqrt(2))
+
+def sidak(confidence, tests):
+    """family-wise confidence of the best of several independent tests"""
+    return confidence ** tests
+
+
+start = time.time()
+
+# a single training access can never establish a stride, so it serves as control for every cell
+run_utils.comp("test_prefetch_simple", TIMER, VICTIM, BASE_FLAGS, CORES, quiet=True)
+control = run_simple(STRIDES[1], 1, True)
+strides = {stride: run_simple(stride, ACCESSES, True) for stride in STRIDES}
+unaligned = run_simple(STRIDES[1], ACCESSES, False)
+
+run_utils.comp("test_prefetch_both_collisions", TIMER, VICTIM, BASE_FLAGS, CORES, quiet=True)
+collision_control = run_collision(STRIDES[1], 1, COLLISION_BIT)
+collision = run_collision(STRIDES[1], ACCESSES, COLLISION_BIT)
+
+# the best of len(STRIDES) tests against the same control: Sidak correction, the family-wise confidence that at least
+# one stride beats the control is the confidence of the best one to the power of the number of strides tested
+stride_confidence = sidak(max(confidence(hits, control) for hits in strides.values()), len(STRIDES))
+aligned_confidence = confidence(strides[STRIDES[1]], control)
+unaligned_confidence = confidence(unaligned, control)
+collision_confidence = confidence(collision, collision_control)
+
+verdict = {
+    "host": platform.node(),
+    "cpu": param_utils.cpu_model(),
+    "timer": TIMER,
+    "victim": VICTIM,
+    "trials": TRIALS,
+    "stride_prefetcher": stride_confidence >= CONFIDENCE,
+    "stride_confidence": round(stride_confidence, 4),
+    "strides": {str(stride): hits for stride, hits in strides.items()},
+    "control": control,
+    "aligned": {"hits": strides[STRIDES[1]], "confidence": round(aligned_confidence, 4)},
+    "unaligned": {"hits": unaligned, "confidence": round(unaligned_confidence, 4)},
+    "pc_collision": collision_confidence >= CONFIDENCE,
+    "pc_collision_bit": COLLISION_BIT,
+    "pc_collision_confidence": round(collision_confidence, 4),
+    "pc_collision_hits": collision,
+    "pc_collision_control": collision_control,
+    "duration": round(time.time() - start, 2),
+}
+
+with open("out/fingerprint.json", "w") as out:
+    json.dump(verdict, out)
+
+print(json.dumps(verdict))
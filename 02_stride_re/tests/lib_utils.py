@@ -0,0 +1,111 @@
+import ctypes
+import hashlib
+import os
+import shutil
+
+import run_utils
+import trace_utils
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+# in-process trials through libstride_re.so (see lib/stride_re.h), the counterpart of run_utils.run for analysis loops
+# that need many cells: no process start, no calibration per cell and no stdout parsing.
+#
+#   with lib_utils.StrideRE(TIMER, VICTIM, FLAGS, CORES) as sr:
+#       hits, times, classified = sr.run(stride, accesses, start_offset, access_offset, measure_offset, 100)
+#
+# times and classified are NumPy arrays if NumPy is installed and ctypes arrays (buffer protocol) otherwise.
+# Flags are compiled into the library, so every flag set gets its own copy in out/lib and its own instance.
+
+ABI_VERSION = 2
+
+class Variant(ctypes.Structure):
+    _fields_ = [
+        ("stride", ctypes.c_int64),
+        ("accesses", ctypes.c_int32),
+        ("repeats", ctypes.c_int32),
+        ("start_offset", ctypes.c_uint64),
+        ("access_offset", ctypes.c_uint64),
+        ("measure_offset", ctypes.c_uint64),
+    ]
+
+class Stats(ctypes.Structure):
+    _fields_ = [
+        ("threshold", ctypes.c_uint64),
+        ("initial_threshold", ctypes.c_uint64),
+        ("trials", ctypes.c_uint64),
+        ("unseparable", ctypes.c_int32),
+        ("rejected", ctypes.c_int32),
+        ("rejected_batches", ctypes.c_int32),
+        ("hit", ctypes.c_double),
+        ("miss", ctypes.c_double),
+    ]
+
+def build(TIMER, VICTIM, FLAGS, CORES):
+    run_utils.comp("lib", TIMER, VICTIM, FLAGS, CORES, quiet=True)
+    # dlopen returns the already loaded library for a known path, so a rebuilt library needs a new name
+    key = hashlib.sha1(" ".join([TIMER, VICTIM, CORES] + FLAGS).encode()).hexdigest()[:12]
+    os.makedirs("out/lib", exist_ok=True)
+    path = os.path.abspath(f"out/lib/libstride_re_{key}.so")
+    shutil.copyfile("libstride_re.so", path)
+    return path
+
+def _array(ctype, count):
+    if numpy is not None:
+        array = numpy.zeros(count, dtype=numpy.uint64 if ctype is ctypes.c_uint64 else numpy.uint8)
+        return array, array.ctypes.data_as(ctypes.POINTER(ctype))
+    array = (ctype * count)()
+    return array, array
+
+class StrideRE:
+
+    def __init__(self, TIMER, VICTIM, FLAGS, CORES, repeats=0, path=None):
+        # repeats 0: PREFETCH_REPEATS of the build
+        self.repeats = repeats
+        self.lib = ctypes.CDLL(path or build(TIMER, VICTIM, FLAGS, CORES))
+        self.lib.sr_init.argtypes = [ctypes.c_int]
+        self.lib.sr_configure.argtypes = [ctypes.POINTER(Variant)]
+        self.lib.sr_run.argtypes = [ctypes.c_uint64, ctypes.POINTER(ctypes.c_uint64), ctypes.POINTER(ctypes.c_uint8)]
+        self.lib.sr_run.restype = ctypes.c_int64
+        self.lib.sr_stats.argtypes = [ctypes.POINTER(Stats)]
+
+        version = self.lib.sr_abi_version()
+        if version != ABI_VERSION:
+            raise RuntimeError(f"libstride_re ABI version {version}, expected {ABI_VERSION}")
+        # the worker thread pins itself, the interpreter may run anywhere
+        core = int(CORES.replace("-", ",").split(",")[0])
+        with trace_utils.phase("lib init", core=core):
+            if self.lib.sr_init(core):
+                raise RuntimeError("sr_init failed")
+        self.open = True
+
+    def run(self, stride, accesses, start_offset, access_offset, measure_offset, trials, repeats=None):
+        variant = Variant(stride, accesses, self.repeats if repeats is None else repeats, start_offset, access_offset, measure_offset)
+        if self.lib.sr_configure(ctypes.byref(variant)):
+            raise ValueError(f"invalid variant {stride} {accesses} {start_offset} {access_offset} {measure_offset}")
+        times, times_pointer = _array(ctypes.c_uint64, trials)
+        classified, classified_pointer = _array(ctypes.c_uint8, trials)
+        with trace_utils.phase("lib run", trials=trials):
+            hits = self.lib.sr_run(trials, times_pointer, classified_pointer)
+        if hits < 0:
+            raise RuntimeError("sr_run failed")
+        return hits, times, classified
+
+    def stats(self):
+        stats = Stats()
+        self.lib.sr_stats(ctypes.byref(stats))
+        return stats
+
+    def close(self):
+        if self.open:
+            self.lib.sr_destroy()
+            self.open = False
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
@@ -1,4 +1,7 @@
+import json
 import os
+import platform
+import re
 
 def get_results_for(name):
     
@@ -20,3 +23,53 @@ def get_results_for(name):
         
         results[tuple(params)] = globs
     return results
+
+def cpu_model():
+    # "model name" on x86, "Model" on arm64
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name") or line.startswith("Model"):
+                    return line.split(":", 1)[1].strip()
+    except OSError:
+        pass
+    return platform.processor()
+
+# CPU profile: the best harness configuration per timer / victim as found by autotune.py, keyed by CPU model so
+# profiles of several machines can share out/profile.json
+PROFILE = "out/profile.json"
+
+def load_profile(TIMER, VICTIM):
+    """returns the tuned configuration ({"flags": [...], "score": ..., ...}) or None"""
+    if not os.path.exists(PROFILE):
+        return None
+    with open(PROFILE) as f:
+        profiles = json.load(f)
+    return profiles.get(cpu_model(), dict()).get(f"{TIMER},{VICTIM}")
+
+def save_profile(TIMER, VICTIM, configuration):
+    profiles = dict()
+    if os.path.exists(PROFILE):
+        with open(PROFILE) as f:
+            profiles = json.load(f)
+    profiles.setdefault(cpu_model(), dict())[f"{TIMER},{VICTIM}"] = configuration
+    with open(PROFILE, "w") as out:
+        json.dump(profiles, out, indent=4)
+
+# gadget farm of the kernel victim (auto_tool_module.h): the test binaries select a gadget by index (last argument of
+# test_prefetch_both_collisions), so a sweep over PC bits needs no module reload
+FARM_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "victim", "kernel", "kernel_module", "auto_tool_module.h")
+
+def farm_layout():
+    """gadget farm constants of the kernel module"""
+    with open(FARM_HEADER) as header:
+        defines = dict(re.findall(r"#define (GADGET_\w+) (\d+)\n", header.read()))
+    return {name: int(value) for name, value in defines.items()}
+
+def farm_bit_index(bit):
+    """index of the kernel module's gadget that differs from its base gadget only in the given bit (None if there is none)"""
+    farm = farm_layout()
+    if not farm["GADGET_BITS_FIRST"] <= bit <= farm["GADGET_BITS_LAST"]:
+        return None
+    base = farm["GADGET_FARM_PAGES"] * farm["GADGET_FARM_PER_PAGE"]
+    return base + 1 + bit - farm["GADGET_BITS_FIRST"]
@@ -0,0 +1,302 @@
+import itertools
+import json
+import os
+import random
+import statistics
+import sys
+import time
+
+import param_utils
+import plot_utils
+import run_utils
+import trace_utils
+
+# declarative experiments: a spec (tests/specs/*.py) describes the parameter axes, argument / offset expressions, flags
+# and stopping rule of an experiment, the planner turns one or more specs into trial plans and runs them.
+#
+#   python3 plan_utils.py <CORES> <TIMER> <VICTIM> <spec.py>... [--dry-run] [--seed=<n>] [--profile]
+#
+# A spec is a Python file setting these variables (PAGE_SIZE and CACHE_LINE_SIZE are predefined):
+#
+#   test        binary to run, e.g. "test_prefetch_simple"
+#   axes        dict of axis name -> values. The first axis becomes the rows (y_ticks), the product of the others
+#               the columns (x_ticks) of the output
+#   arguments   list of expressions (strings) over the axes, one per command-line argument of the test. The expressions
+#               also see timer and victim of the build and everything the spec defines (helpers, constants). An
+#               argument that evaluates to None is left out (optional trailing arguments)
+#   where       optional expression, cells for which it is false are skipped
+#   flags       flags of every build, e.g. ["-DEVAL"]
+#   flag_axes   list of alternatives that are combined, e.g. [[[], ["-DUSE_FENCE"]], [[], ["-DACCESS_MEMORY"]]]
+#   victim_flags    dict of victim -> additional flags, e.g. {"userspace": ["-DVICTIM_BUFFER_SIZE=0x8000"]}
+#   timers, victims optional lists that replace TIMER / VICTIM of the command line
+#   repeats     maximal number of runs per cell (default 5)
+#   stop        optional early stop: {"min": 2, "low": 5, "high": 50} stops a cell after at least min runs if the mean
+#               result is <= low or >= high (clearly no prefetch / clearly prefetch)
+#   result      None for the first R line (hit count of the prefetch tests) or a key like "hits" for "R hits: <n>"
+#   name        output name (default: name of the spec file)
+#
+# The planner expands all specs into cells (build, arguments). Cells that appear in several specs (or several times in
+# one) are measured once. Cells are grouped by build, so every build is compiled once, and run in rounds: every round
+# runs all cells that did not stop yet in a new random order, so slow drift spreads over all cells instead of biasing
+# neighbours. With SL_INPROCESS=1, test_prefetch_simple cells run in-process through libstride_re (lib_utils).
+#
+# --profile replaces the flag_axes of every spec with the configuration autotune.py found for this CPU.
+#
+# Before it starts, the planner prints the number of cells and builds and a runtime estimate based on the timings
+# of earlier plans (out/plan_timings.json). Every spec writes out/<name>_<timer,victim,flags>.py with repeats,
+# x_ticks, y_ticks and data (sums over repeats, as written by the hand-written tests) plus the runs of every cell, the
+# metadata of every run (noise score of the measurement core and settled frequency, see run_utils.parse_metadata) and
+# the trial counters of every run (see COUNTERS).
+
+PAGE_SIZE = 4096
+CACHE_LINE_SIZE = 64
+
+TIMINGS = "out/plan_timings.json"
+DEFAULT_TIMINGS = {"compile": 2.0, "run": 0.2, "inprocess": 0.01}
+
+INPROCESS_TESTS = ["test_prefetch_simple"]
+
+# trial counters of tests/trial.h, reported as "R <counter>: <n>" after the results of a cell and kept per run, None
+# for runs of tests that do not report them. unseparable: trials measured while the hit and miss canaries were not
+# separable, their results are questionable. rejected: disturbed trials that were repeated. rejected_batches: batches
+# repeated after an interrupt (only builds with TRIAL_GUARD_INTERRUPTS)
+COUNTERS = ["unseparable", "rejected", "rejected_batches"]
+
+def load_spec(path):
+    spec = {"PAGE_SIZE": PAGE_SIZE, "CACHE_LINE_SIZE": CACHE_LINE_SIZE, "__file__": os.path.abspath(path)}
+    exec(open(path).read(), spec)
+    spec.setdefault("name", os.path.splitext(os.path.basename(path))[0])
+    spec.setdefault("where", None)
+    spec.setdefault("flags", [])
+    spec.setdefault("flag_axes", [])
+    spec.setdefault("victim_flags", {})
+    spec.setdefault("repeats", 5)
+    spec.setdefault("stop", None)
+    spec.setdefault("result", None)
+    for key in ["test", "axes", "arguments"]:
+        if key not in spec:
+            raise ValueError(f"{path}: spec has no {key}")
+    return spec
+
+def _evaluate(spec, expression, values):
+    return eval(expression, spec, dict(values))
+
+class Plan:
+
+    def __init__(self, specs, TIMER, VICTIM, profile=None):
+        # build -> argument tuple -> cell
+        self.builds = dict()
+        # spec entries: (spec, build, y_ticks, x_ticks, cells as rows of columns)
+        self.outputs = []
+        self.requested = 0
+
+        for spec in specs:
+            names = list(spec["axes"])
+            axes = [list(spec["axes"][name]) for name in names]
+            flag_axes = [[profile["flags"]]] if profile else spec["flag_axes"]
+            flag_sets = [sum(choice, []) for choice in itertools.product(*flag_axes)]
+            for timer in spec.get("timers", [TIMER]):
+                for victim in spec.get("victims", [VICTIM]):
+                    for flag_set in flag_sets:
+                        flags = spec["flags"] + spec["victim_flags"].get(victim, []) + flag_set
+                        build = (spec["test"], timer, victim, tuple(flags), spec["result"])
+                        cells = self.builds.setdefault(build, dict())
+                        rows = []
+                        for y in axes[0]:
+                            row = []
+                            for x in itertools.product(*axes[1:]):
+                                values = dict(zip(names, (y,) + x), timer=timer, victim=victim)
+                                if spec["where"] and not _evaluate(spec, spec["where"], values):
+                                    row.append(None)
+                                    continue
+                                arguments = [_evaluate(spec, expression, values) for expression in spec["arguments"]]
+                                arguments = tuple(str(argument) for argument in arguments if argument is not None)
+                                cell = cells.setdefault(arguments, {"runs": [], "metadata": [], **{counter: [] for counter in COUNTERS}, "repeats": 0, "stop": None, "specs": 0})
+                                # a cell shared by several specs runs as often as the most demanding one wants
+                                cell["repeats"] = max(cell["repeats"], spec["repeats"])
+                                cell["stop"] = spec["stop"] if not cell["specs"] else _stricter(cell["stop"], spec["stop"])
+                                cell["specs"] += 1
+                                row.append(cell)
+                                self.requested += 1
+                            rows.append(row)
+                        x_ticks = [x[0] if len(x) == 1 else x for x in itertools.product(*axes[1:])]
+                        self.outputs.append((spec, build, axes[0], x_ticks, rows))
+
+    def cells(self):
+        return sum(len(cells) for cells in self.builds.values())
+
+    def estimate(self, timings, inprocess):
+        # lower bound: every cell with a stopping rule stops as early as possible
+        low = high = timings["compile"] * len(self.builds)
+        for build, cells in self.builds.items():
+            per_run = timings["inprocess"] if inprocess and build[0] in INPROCESS_TESTS else timings["run"]
+            for cell in cells.values():
+                stop = cell["stop"]
+                low += per_run * (min(stop["min"], cell["repeats"]) if stop else cell["repeats"])
+                high += per_run * cell["repeats"]
+        return low, high
+
+    def summary(self, timings, inprocess):
+        low, high = self.estimate(timings, inprocess)
+        print(f"{self.requested} cells requested, {self.cells()} unique, {len(self.builds)} builds")
+        print(f"estimated runtime: {_duration(low)} - {_duration(high)}")
+
+def _stricter(a, b):
+    # keep measuring until both specs are satisfied
+    if a is None or b is None:
+        return None
+    return {"min": max(a["min"], b["min"]), "low": min(a["low"], b["low"]), "high": max(a["high"], b["high"])}
+
+def _duration(seconds):
+    return time.strftime("%H:%M:%S", time.gmtime(seconds))
+
+def _done(cell):
+    runs = [run for run in cell["runs"] if run >= 0]
+    if len(cell["runs"]) >= cell["repeats"]:
+        return True
+    stop = cell["stop"]
+    if not stop or len(runs) < stop["min"]:
+        return False
+    mean = statistics.mean(runs)
+    return mean <= stop["low"] or mean >= stop["high"]
+
+def _parse(r, result):
+    for line in r.results:
+        if result is None:
+            return int(line)
+        if line.startswith(f"{result}: "):
+            return int(line.split(": ")[1])
+    return -1
+
+def _counters(r):
+    counters = dict.fromkeys(COUNTERS)
+    for line in r.results:
+        key, _, value = line.partition(": ")
+        if key in counters:
+            counters[key] = int(value)
+    return counters
+
+def _library_counters(stats):
+    return {counter: getattr(stats, counter) for counter in COUNTERS}
+
+def load_timings():
+    timings = dict(DEFAULT_TIMINGS)
+    if os.path.exists(TIMINGS):
+        with open(TIMINGS) as f:
+            timings.update(json.load(f))
+    return timings
+
+def save_timings(timings, measured):
+    # moving average, so a single slow plan does not dominate future estimates
+    for key, samples in measured.items():
+        if samples:
+            timings[key] = 0.7 * timings[key] + 0.3 * statistics.mean(samples)
+    with open(TIMINGS, "w") as out:
+        json.dump(timings, out, indent=4)
+
+def execute(plan, CORES, inprocess=False, seed=None):
+    shuffle = random.Random(seed)
+    measured = {"compile": [], "run": [], "inprocess": []}
+
+    for build, cells in plan.builds.items():
+        test, timer, victim, flags, result = build
+        use_library = inprocess and test in INPROCESS_TESTS
+        print(f"{test} {','.join([timer, victim] + list(flags))}: {len(cells)} cells")
+
+        start = time.monotonic()
+        if use_library:
+            import lib_utils
+            library = lib_utils.StrideRE(timer, victim, list(flags), CORES)
+        else:
+            run_utils.comp(test, timer, victim, list(flags), CORES, quiet=True)
+        measured["compile"].append(time.monotonic() - start)
+
+        try:
+            active = list(cells.items())
+            while active:
+                shuffle.shuffle(active)
+                with trace_utils.phase("round", test=test, cells=len(active)):
+                    for arguments, cell in active:
+                        start = time.monotonic()
+                        if use_library:
+                            # the counters of the library add up over all runs
+                            before = _library_counters(library.stats())
+                            hits, _, _ = library.run(*map(int, arguments), 100)
+                            counters = {counter: value - before[counter] for counter, value in _library_counters(library.stats()).items()}
+                            cell["runs"].append(hits)
+                            cell["metadata"].append({})
+                            measured["inprocess"].append(time.monotonic() - start)
+                        else:
+                            r = run_utils.run(test, list(arguments), cores=CORES)
+                            counters = _counters(r)
+                            cell["runs"].append(_parse(r, result))
+                            cell["metadata"].append(r.metadata)
+                            measured["run"].append(time.monotonic() - start)
+                        for counter, value in counters.items():
+                            cell[counter].append(value)
+                active = [(arguments, cell) for arguments, cell in active if not _done(cell)]
+        finally:
+            if use_library:
+                library.close()
+    return measured
+
+def write(plan):
+    for spec, build, y_ticks, x_ticks, rows in plan.outputs:
+        test, timer, victim, flags, result = build
+        repeats = spec["repeats"]
+        # early stopped cells are scaled to repeats, so thresholds like repeats * 100 / 4 keep working
+        data = [[-1 if cell is None or any(run < 0 for run in cell["runs"]) else round(statistics.mean(cell["runs"]) * repeats) for cell in row] for row in rows]
+        runs = [[None if cell is None else cell["runs"] for cell in row] for row in rows]
+        metadata = [[None if cell is None else cell["metadata"] for cell in row] for row in rows]
+        name = f"out/{spec['name']}_{','.join([timer, victim] + list(flags))}"
+        names = list(spec["axes"])
+
+        try:
+            plot_utils.try_heatmap(name, "", ",".join(names[1:]), names[0], x_ticks, y_ticks, data)
+        except ImportError:
+            pass
+
+        with open(f"{name}.py", "w") as out:
+            out.write(f"repeats = {repeats}\n")
+            out.write(f"x_ticks = {x_ticks}\n")
+            out.write(f"y_ticks = {y_ticks}\n")
+            out.write(f"data = {data}\n")
+            out.write(f"runs = {runs}\n")
+            out.write(f"metadata = {metadata}\n")
+            for counter in COUNTERS:
+                out.write(f"{counter} = {[[None if cell is None else cell[counter] for cell in row] for row in rows]}\n")
+
+if __name__ == "__main__":
+    options = [argument for argument in sys.argv[1:] if argument.startswith("--")]
+    positional = [argument for argument in sys.argv[1:] if not argument.startswith("--")]
+    if len(positional) < 4:
+        print(f"usage: python3 {sys.argv[0]} <CORES> <TIMER> <VICTIM> <spec.py>... [--dry-run] [--seed=<n>] [--profile]")
+        sys.exit(1)
+
+    CORES, TIMER, VICTIM = positional[:3]
+    seed = None
+    for option in options:
+        if option.startswith("--seed="):
+            seed = int(option.split("=")[1])
+    inprocess = os.environ.get("SL_INPROCESS") == "1"
+
+    profile = None
+    if "--profile" in options:
+        profile = param_utils.load_profile(TIMER, VICTIM)
+        if not profile:
+            print(f"no profile for {param_utils.cpu_model()} ({TIMER}, {VICTIM}), run autotune.py first")
+            sys.exit(1)
+        print(f"profile: {' '.join(profile['flags'])}")
+
+    os.makedirs("out", exist_ok=True)
+    plan = Plan([load_spec(path) for path in positional[3:]], TIMER, VICTIM, profile)
+    timings = load_timings()
+    plan.summary(timings, inprocess)
+    if "--dry-run" in options:
+        sys.exit(0)
+
+    start = time.monotonic()
+    measured = execute(plan, CORES, inprocess, seed)
+    write(plan)
+    save_timings(timings, measured)
+    print(f"took {_duration(time.monotonic() - start)}")
@@ -1,9 +1,10 @@
 import os
 import subprocess
+import trace_utils
 
 class RunResult:
 
-    def __init__(self, retval, debugs, infos, warnings, errors, fatals, results):
+    def __init__(self, retval, debugs, infos, warnings, errors, fatals, results, metadata=None):
         self.retval = retval
         self.debugs = debugs
         self.infos = infos
@@ -11,6 +12,19 @@ class RunResult:
         self.errors = errors
         self.fatals = fatals
         self.results = results
+        # key=value pairs of the "[<component>] metadata: ..." lines on stderr (common/env.h, common/warmup.h)
+        self.metadata = metadata or {}
+
+def parse_metadata(stderr):
+    metadata = {}
+    for line in stderr.split("\n"):
+        if "] metadata: " not in line or not line.startswith("["):
+            continue
+        component = line[1:line.index("]")]
+        for pair in line.split("] metadata: ", 1)[1].split():
+            key, _, value = pair.partition("=")
+            metadata[f"{component}_{key}"] = value
+    return metadata
 
 def get_sibling_hyperthread(hyperthread):
     with open(f'/sys/devices/system/cpu/cpu{hyperthread}/topology/thread_siblings_list', 'r') as f:
@@ -23,12 +37,14 @@ def get_other_core(hyperthread):
     sibling = get_sibling_hyperthread(hyperthread)
     return max(sibling, hyperthread)+1
 
-def comp(test, TIMER, VICTIM, FLAGS, CORES):
+def comp(test, TIMER, VICTIM, FLAGS, CORES, quiet=False):
 
     victim=VICTIM
     additional_flags=[]
     if VICTIM == "hyperthread":
         additional_flags+=[f"-DTHREAD_CORE={get_sibling_hyperthread(int(CORES))}"]
+    elif VICTIM == "process":
+        additional_flags+=[f"-DTHREAD_CORE={get_sibling_hyperthread(int(CORES))}"]
     elif VICTIM == "core":
         victim="hyperthread"
         additional_flags+=[f"-DTHREAD_CORE={get_other_core(int(CORES))}"]
@@ -36,11 +52,13 @@ def comp(test, TIMER, VICTIM, FLAGS, CORES):
     os.environ["AUTO_TOOL_TIMER"] = TIMER
     os.environ["AUTO_TOOL_VICTIM"] = victim
     os.environ["AUTO_TOOL_FLAGS"] = " ".join(FLAGS+additional_flags)
-    os.system(f"cd ..; make {test}")
+    with trace_utils.phase("compile", test=test, flags=os.environ["AUTO_TOOL_FLAGS"]):
+        os.system(f"cd ..; make {test}" + (" >/dev/null 2>&1" if quiet else ""))
     
 def run(test, args, cores="1"):
-    p = subprocess.Popen(["taskset", "-c", cores, f"./{test}"] + args, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
-    stdout, stderr = p.communicate()
+    with trace_utils.phase("run", test=test, args=" ".join(args)):
+        p = subprocess.Popen(["taskset", "-c", cores, f"./{test}"] + args, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        stdout, stderr = p.communicate()
     debugs = []
     infos = []
     warnings = []
@@ -77,4 +95,4 @@ def run(test, args, cores="1"):
         elif kind == "R":
             results.append(data)
     
-    return RunResult(p.returncode, debugs, infos, warnings, errors, fatals, results)
+    return RunResult(p.returncode, debugs, infos, warnings, errors, fatals, results, parse_metadata(stderr.decode()))
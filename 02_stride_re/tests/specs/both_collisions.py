@@ -0,0 +1,27 @@
+# memory-address part of test_prefetch_both_collisions.py as a spec: which bit of the buffer address may differ (the PC
+# part is both_collisions_pc.py)
+test = "test_prefetch_both_collisions"
+BITS = 47
+axes = {
+    "stride": [512, 768, 1024, 2048],
+    "aligned": [True, False],
+    "accesses": range(1, 5),
+    "bit": range(BITS),
+}
+arguments = [
+    "stride",
+    "accesses",
+    "0 if aligned else 2 * stride",
+    "stride * accesses if aligned else 0",
+    "stride * (accesses + 1) if aligned else stride",
+    "'0x7fffffffffff'",
+    "f'0x{1 << bit:016x}'",
+    "'0x7fffffffffff'",
+    f"'0x{1 << (BITS - 1):016x}'",
+    "20",
+]
+# add "-DUSE_JIT" to train through a routine emitted by jit.h (see test_prefetch_both_collisions.c)
+flags = ["-DEVAL"]
+flag_axes = [[[], ["-DUSE_FENCE"]], [[], ["-DACCESS_MEMORY"]]]
+victim_flags = {"userspace": ["-DVICTIM_BUFFER_SIZE=0x4000"]}
+repeats = 2
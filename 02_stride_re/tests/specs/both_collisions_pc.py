@@ -0,0 +1,38 @@
+# PC part of test_prefetch_both_collisions.py as a spec: which bit of the load address may differ. The kernel victim
+# flips the bit on its side with a gadget of its farm (see param_utils.farm_bit_index), bits the farm cannot reach are
+# flipped on the colliding load like with the other victims
+import param_utils
+
+test = "test_prefetch_both_collisions"
+BITS = 47
+axes = {
+    "stride": [512, 768, 1024, 2048],
+    "aligned": [True, False],
+    "accesses": range(1, 5),
+    "bit": range(BITS),
+}
+
+def gadget_index(victim, bit):
+    return param_utils.farm_bit_index(bit) if victim == "kernel" else None
+
+def load_xor(victim, bit):
+    return 0 if gadget_index(victim, bit) is not None else 1 << bit
+
+arguments = [
+    "stride",
+    "accesses",
+    "0 if aligned else 2 * stride",
+    "stride * accesses if aligned else 0",
+    "stride * (accesses + 1) if aligned else stride",
+    "'0x7fffffffffff'",
+    f"'0x{1 << (BITS - 1):016x}'",
+    "'0x7fffffffffff'",
+    "f'0x{load_xor(victim, bit):016x}'",
+    "20",
+    "gadget_index(victim, bit)",
+]
+# add "-DUSE_JIT" to train through a routine emitted by jit.h (see test_prefetch_both_collisions.c)
+flags = ["-DEVAL"]
+flag_axes = [[[], ["-DUSE_FENCE"]], [[], ["-DACCESS_MEMORY"]]]
+victim_flags = {"userspace": ["-DVICTIM_BUFFER_SIZE=0x4000"]}
+repeats = 2
@@ -0,0 +1,21 @@
+# test_prefetch_cross_page.py as a spec: the trigger access is always on the last cache line of a page
+test = "test_prefetch_simple"
+axes = {
+    "stride": range(64, 4096 + 1, 64),
+    "aligned": [True, False],
+    "accesses": range(1, 5),
+}
+# aligned: smallest start offset that puts start + stride * accesses on the last cache line of its page
+arguments = [
+    "stride",
+    "accesses",
+    "(PAGE_SIZE - CACHE_LINE_SIZE - stride * accesses) % PAGE_SIZE if aligned else PAGE_SIZE - CACHE_LINE_SIZE + 2 * stride",
+    "(PAGE_SIZE - CACHE_LINE_SIZE - stride * accesses) % PAGE_SIZE + stride * accesses if aligned else PAGE_SIZE - CACHE_LINE_SIZE",
+    "(PAGE_SIZE - CACHE_LINE_SIZE - stride * accesses) % PAGE_SIZE + stride * (accesses + 1) if aligned else PAGE_SIZE - CACHE_LINE_SIZE + stride",
+]
+flags = ["-DEVAL"]
+flag_axes = [[[], ["-DUSE_FENCE"]], [[], ["-DACCESS_MEMORY"]]]
+# max. stride 4096 and 4 accesses, 32KB victim buffer (also for 16KB pages)
+victim_flags = {"userspace": ["-DVICTIM_BUFFER_SIZE=0x8000"]}
+repeats = 5
+stop = {"min": 2, "low": 2, "high": 80}
@@ -0,0 +1,19 @@
+# stride / access-count sweep of test_prefetch_simple.py as a spec (python3 plan_utils.py <CORES> <TIMER> <VICTIM> specs/prefetch_simple.py)
+test = "test_prefetch_simple"
+axes = {
+    "stride": range(64, 16448 + 1, 64),
+    "aligned": [True, False],
+    "accesses": range(1, 5),
+}
+# aligned: train from 0, trigger right after the last training access. unaligned: train from 2 * stride, trigger at 0
+arguments = [
+    "stride",
+    "accesses",
+    "0 if aligned else 2 * stride",
+    "stride * accesses if aligned else 0",
+    "stride * (accesses + 1) if aligned else stride",
+]
+flags = ["-DEVAL"]
+flag_axes = [[[], ["-DUSE_FENCE"]], [[], ["-DACCESS_MEMORY"]]]
+repeats = 5
+stop = {"min": 2, "low": 2, "high": 80}
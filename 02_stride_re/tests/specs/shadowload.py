@@ -0,0 +1,22 @@
+# test_shadowload.py as a spec: aligned / unaligned x cached / uncached (always uses the kernel victim, see make test_shadow_load)
+test = "test_shadow_load"
+axes = {
+    "accesses": [2, 3, 4],
+    "aligned": [1, 0],
+    "flush_all": [0, 1],
+}
+arguments = [
+    "512",
+    "accesses",
+    "aligned",
+    "'0x7fffffffffff'",
+    f"'0x{1 << 46:016x}'",
+    "'0x7fffffffffff'",
+    f"'0x{1 << 46:016x}'",
+    "flush_all",
+    "100",
+]
+flags = ["-DEVAL"]
+victim_flags = {"userspace": ["-DVICTIM_BUFFER_SIZE=0x4000"]}
+result = "hits"
+repeats = 1000
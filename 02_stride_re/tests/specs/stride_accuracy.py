@@ -0,0 +1,21 @@
+# test_stride_accuracy.py as a spec: how far (delta bytes) the trigger access may be off the stride.
+# Measures all deltas instead of stopping at the first one that changes the access count, the analysis is offline.
+test = "test_prefetch_simple"
+axes = {
+    "stride": [192, 256, 512, 768, 1024],
+    "aligned": [True, False],
+    "delta": range(64),
+    "accesses": range(1, 7),
+}
+arguments = [
+    "stride",
+    "accesses",
+    "0 if aligned else 2 * stride",
+    "stride * accesses + delta if aligned else delta",
+    "stride * (accesses + 1) if aligned else stride",
+]
+flags = ["-DEVAL"]
+flag_axes = [[[], ["-DUSE_FENCE"]], [[], ["-DACCESS_MEMORY"]]]
+victim_flags = {"userspace": ["-DVICTIM_BUFFER_SIZE=0x8000"]}
+repeats = 3
+stop = {"min": 2, "low": 2, "high": 80}
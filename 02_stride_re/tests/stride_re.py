@@ -2,10 +2,14 @@ import sys
 import os
 import time
 
-if len(sys.argv) == 4:
-    CORES = sys.argv[1]
-    TIMER = sys.argv[2]
-    VICTIM = sys.argv[3]
+# quick (<10 s) check whether the CPU has a stride prefetcher that can be trained across domains
+FINGERPRINT = "--fingerprint" in sys.argv
+args = [arg for arg in sys.argv[1:] if arg != "--fingerprint"]
+
+if len(args) == 3:
+    CORES = args[0]
+    TIMER = args[1]
+    VICTIM = args[2]
 else:
     CORES = "1"
     TIMER = "rdtsc"
@@ -16,6 +20,10 @@ os.system("mkdir out")
 # turn off those segfault messages
 os.system("sysctl -w debug.exception-trace=0")
 
+if FINGERPRINT:
+    os.system(f"python3 fingerprint.py {CORES} {TIMER} {VICTIM}")
+    quit()
+
 scripts = [
     "test_prefetch_simple",
     "test_prefetch_cross_page",
@@ -1,21 +1,38 @@
 #include "tests/common.h"
+#include "tests/trial.h"
+
+// -DUSE_JIT (AUTO_TOOL_JIT=1 for make, --jit for test_prefetch_both_collisions.py, "-DUSE_JIT" in the flags of a
+// spec): every training round is a single call of a routine emitted by jit.h, whose load sits at the colliding load
+// address, instead of one call of the copied load gadget per access. Training then costs one call and no C loop
+#ifdef USE_JIT
+    #include "jit.h"
+#endif /* USE_JIT */
 
 #define MAX(a, b) (a > b ? a : b)
 #define MIN(a, b) (a > b ? b : a)
 
 #ifdef ACCESS_MEMORY
-    #define DUMMY_BUFFER_SIZE (PAGE_SIZE * 10)
+    #ifndef DUMMY_BUFFER_SIZE
+        #define DUMMY_BUFFER_SIZE (PAGE_SIZE * 10)
+    #endif /* DUMMY_BUFFER_SIZE */
     static uint8_t* dummy_buffer;
 #endif /* ACCESS_MEMORY */
 
 static uint8_t* colliding_buffer;
 static load_gadget_f colliding_load;
 
+#ifdef USE_JIT
+    // whole training round (all accesses from the colliding load address) in a single call
+    static struct jit_routine colliding_training;
+#endif /* USE_JIT */
+
 static uint64_t prefetch(int64_t stride, int accesses, uint64_t start_offset, uint64_t access_offset, uint64_t measure_offset) {
     
+    uint64_t trace = trace_begin();
     victim_flush_buffer();
 
     mfence();
+    trace_end(TRACE_FLUSH, trace);
     
     #ifdef ACCESS_MEMORY
         // some CPUs seem to only prefetch if there is a lot of memory accesses recently
@@ -28,23 +45,31 @@ static uint64_t prefetch(int64_t stride, int accesses, uint64_t start_offset, ui
     #endif /* USE_NOP */
     
     
-    // repeating 5 times is not necessary, but there is no reason not to (and it may increase chance of success)
-    for(int repeat = 0; repeat < 5; repeat ++) {
+    trace = trace_rounds_begin();
+    // repeating PREFETCH_REPEATS (default 5) times is not necessary, but there is no reason not to (and it may increase chance of success)
+    for(int repeat = 0; repeat < PREFETCH_REPEATS; repeat ++) {
         
-        for(int access = 0; access < accesses; access++) {
-            colliding_load(&colliding_buffer[start_offset + (access % accesses) * stride]);
-            #ifdef USE_FENCE
-                mfence();
-            #endif /* USE_FENCE */
-        }
+        uint64_t round = trace_round_begin();
+        #ifdef USE_JIT
+        colliding_training.call(&colliding_buffer[start_offset]);
+        #else
+        CORE_TRAIN(accesses, access, colliding_load(&colliding_buffer[start_offset + access * stride]); train_fence());
+        #endif /* USE_JIT */
+        trace_round_end(TRACE_TRAIN, round);
         
+        round = trace_round_begin();
         victim_load_gadget(access_offset);
         #ifdef USE_FENCE
             mfence();
         #endif /* USE_FENCE */
+        trace_round_end(TRACE_TRIGGER, round);
     }
+    trace_rounds_end(trace);
     
-    return victim_probe(measure_offset);
+    trace = trace_begin();
+    uint64_t time = victim_probe(measure_offset);
+    trace_end(TRACE_PROBE, trace);
+    return time;
 }
 
 
@@ -71,10 +96,12 @@ int main(int argc, char** argv) {
         #endif /* ACCESS_MEMORY */
     );
     
-    if(argc != 11) {
-        FATAL("usage %s <stride> <accesses> <start_offset> <access_offset> <measure_offset> <colliding_buffer_address_and> <colliding_buffer_address_xor> <colliding_load_address_and> <colliding_load_address_xor> <repeats>\n", argv[0]);
+    if(argc != 11 && argc != 12) {
+        FATAL("usage %s <stride> <accesses> <start_offset> <access_offset> <measure_offset> <colliding_buffer_address_and> <colliding_buffer_address_xor> <colliding_load_address_and> <colliding_load_address_xor> <repeats> [victim_gadget_index]\n", argv[0]);
     }
     
+    env_setup();
+    
     if(time_init()) {
         FATAL("failed to initialize timer!\n");
     }
@@ -83,13 +110,31 @@ int main(int argc, char** argv) {
         FATAL("failed to initialize victim!\n");
     }
     
+    // select the victim load among the gadget farm of the victim (if it has one), so the victim PC can be varied without remapping.
+    // The colliding load is then placed relative to the base gadget of the farm instead, so only the victim PC moves
+    uintptr_t load_reference = victim_load_address();
+    if(argc == 12) {
+        #ifdef VICTIM_GADGET_FARM
+            if(victim_select_gadget(VICTIM_GADGET_FARM_BASE)) {
+                FATAL("failed to select base gadget of the gadget farm!\n");
+            }
+            load_reference = victim_load_address();
+            if(victim_select_gadget(strtoull(argv[11], NULL, 0))) {
+                FATAL("failed to select victim gadget %s!\n", argv[11]);
+            }
+            DEBUG("victim load gadget: 0x%016zx (base 0x%016zx)\n", victim_load_address(), load_reference);
+        #else
+            FATAL("victim has no gadget farm!\n");
+        #endif /* VICTIM_GADGET_FARM */
+    }
+    
     int64_t stride = strtoll(argv[1], NULL, 0);
     int accesses = atoi(argv[2]);
     uint64_t start_offset = strtoull(argv[3], NULL, 0);
     uint64_t access_offset = strtoull(argv[4], NULL, 0);
     uint64_t measure_offset = strtoull(argv[5], NULL, 0);
     uintptr_t colliding_buffer_address = (victim_buffer_address() & strtoull(argv[6], NULL, 0)) ^ strtoull(argv[7], NULL, 0);
-    uintptr_t colliding_load_address = (victim_load_address() & strtoull(argv[8], NULL, 0)) ^ strtoull(argv[9], NULL, 0);
+    uintptr_t colliding_load_address = (load_reference & strtoull(argv[8], NULL, 0)) ^ strtoull(argv[9], NULL, 0);
     int repeats = atoi(argv[10]);
     
     DEBUG("arguments: stride=%zu, accesses=%d, start_offset=%zu, measure_offset=%zu colliding_buffer_address_and=0x%016zx colliding_buffer_address_or=0x%016zx colliding_load_address_and=0x%016zx colliding_load_address_xor=0x%016zx\n", stride, accesses, start_offset, measure_offset, strtoull(argv[6], NULL, 0), strtoull(argv[7], NULL, 0), strtoull(argv[8], NULL, 0), strtoull(argv[9], NULL, 0));
@@ -120,6 +165,20 @@ int main(int argc, char** argv) {
     }
     colliding_buffer += colliding_buffer_address % PAGE_SIZE;
     
+    #ifdef USE_JIT
+    struct jit_descriptor descriptor = {
+        .load_address = colliding_load_address,
+        .accesses = accesses,
+        .stride = stride,
+        #ifdef USE_FENCE
+        .fence = 1,
+        #endif /* USE_FENCE */
+    };
+    if(jit_emit(&colliding_training, &descriptor)) {
+        FATAL("could not emit training routine with load at 0x%016zx\n", colliding_load_address);
+    }
+    DEBUG("training routine: %p, load: 0x%016zx\n", colliding_training.call, colliding_load_address);
+    #else
     colliding_load = map_load_gadget(colliding_load_address);
     if(!colliding_load) {
         uint64_t load_size = (uintptr_t)_load_gadget_asm_end - (uintptr_t)_load_gadget_asm_start;
@@ -148,6 +207,7 @@ int main(int argc, char** argv) {
     if(!colliding_load) {
         FATAL("could not map colliding load to 0x%016zx\n", colliding_load_address);
     }
+    #endif /* USE_JIT */
     
     #ifdef ACCESS_MEMORY
         dummy_buffer = mmap(NULL, DUMMY_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, 0, 0);
@@ -161,14 +221,21 @@ int main(int argc, char** argv) {
     
     INFO("threshold: %zu\n", threshold);
     
-    int hits = 0;
-    for(int repeat = 0; repeat < repeats; repeat ++) {
-        hits += prefetch(stride, accesses, start_offset, access_offset, measure_offset) < threshold;
+    struct trial_tracker tracker;
+    if(trial_init(&tracker, threshold)) {
+        FATAL("failed to initialize trials!\n");
     }
+    
+    int hits = trial_runs(&tracker, repeats, prefetch(stride, accesses, start_offset, access_offset, measure_offset));
     RESULT("%d\n", hits);
+    trial_report(&tracker);
     
     munmap(colliding_buffer, VICTIM_BUFFER_SIZE);
+    #ifdef USE_JIT
+    jit_release(&colliding_training);
+    #else
     munmap(colliding_load, 2 * PAGE_SIZE);
+    #endif /* USE_JIT */
     
     time_destroy();
     victim_destroy();
@@ -6,19 +6,26 @@ import sys
 PAGE_SIZE = 4096
 CACHE_LINE_SIZE = 64
 
-if len(sys.argv) != 4:
-    print(f"usage: python3 {sys.argv[0]} <CORES> <TIMER> <VICTIM>")
+# --jit trains through a routine emitted by jit.h instead of the copied load gadget (-DUSE_JIT)
+JIT = "--jit" in sys.argv[1:]
+positional = [argument for argument in sys.argv[1:] if argument != "--jit"]
 
-CORES = sys.argv[1]
-TIMER = sys.argv[2]
-VICTIM = sys.argv[3]
+if len(positional) != 3:
+    print(f"usage: python3 {sys.argv[0]} <CORES> <TIMER> <VICTIM> [--jit]")
+
+CORES = positional[0]
+TIMER = positional[1]
+VICTIM = positional[2]
 
 def comp(TIMER, VICTIM, FLAGS):
     global CORES
     run_utils.comp("test_prefetch_both_collisions", TIMER, VICTIM, FLAGS, CORES)
     
-def run(stride, accesses, start_offset, access_offset, measure_offset, colliding_buffer_addr_and, colliding_buffer_addr_xor, colliding_load_addr_and, colliding_load_addr_xor, tests, cores=CORES):
+def run(stride, accesses, start_offset, access_offset, measure_offset, colliding_buffer_addr_and, colliding_buffer_addr_xor, colliding_load_addr_and, colliding_load_addr_xor, tests, cores=CORES, gadget_index=None):
     arguments = [str(stride), str(accesses), str(start_offset), str(access_offset), str(measure_offset), str(colliding_buffer_addr_and), str(colliding_buffer_addr_xor), str(colliding_load_addr_and), str(colliding_load_addr_xor), str(tests)]
+    # the kernel victim can use any gadget of its gadget farm as victim load
+    if gadget_index is not None:
+        arguments.append(str(gadget_index))
     return run_utils.run("test_prefetch_both_collisions", arguments, cores=cores)
 
 def test(prefix, TIMER, VICTIM, FLAGS, strides, diff_bits_mem, diff_bits_pc, accesses, repeats, tests, aligned, buffer_addr, load_addr, save=True):
@@ -35,13 +42,17 @@ def test(prefix, TIMER, VICTIM, FLAGS, strides, diff_bits_mem, diff_bits_pc, acc
     for stride in strides:
         data_row = []
         for diff_bit_pc in diff_bits_pc:
+            # the kernel victim flips the PC bit on its side with a gadget of its farm (one module load covers the
+            # whole sweep), bits the farm cannot reach (see auto_tool_module.h) are flipped on the colliding load
+            gadget_index = param_utils.farm_bit_index(diff_bit_pc) if VICTIM == "kernel" else None
+            load_xor = 0 if gadget_index is not None else 1 << diff_bit_pc
             for diff_bit_mem in diff_bits_mem:
                 res = 0
                 for i in range(repeats):
                     if aligned:
-                        r = run(stride, accesses, 0, stride * accesses, stride * (accesses + 1), "0x7fffffffffff", f"0x{(1 << diff_bit_mem):016x}", "0x7fffffffffff", f"0x{(1 << diff_bit_pc):016x}", tests, cores=CORES)
+                        r = run(stride, accesses, 0, stride * accesses, stride * (accesses + 1), "0x7fffffffffff", f"0x{(1 << diff_bit_mem):016x}", "0x7fffffffffff", f"0x{load_xor:016x}", tests, cores=CORES, gadget_index=gadget_index)
                     else:
-                        r = run(stride, accesses, 2 * stride, 0, stride, "0x7fffffffffff", f"0x{(1 << diff_bit_mem):016x}", "0x7fffffffffff", f"0x{(1 << diff_bit_pc):016x}", tests, cores=CORES)
+                        r = run(stride, accesses, 2 * stride, 0, stride, "0x7fffffffffff", f"0x{(1 << diff_bit_mem):016x}", "0x7fffffffffff", f"0x{load_xor:016x}", tests, cores=CORES, gadget_index=gadget_index)
                     if len(r.results):
                         res += int(r.results[0])
                     else:
@@ -75,7 +86,7 @@ def test(prefix, TIMER, VICTIM, FLAGS, strides, diff_bits_mem, diff_bits_pc, acc
 repeats = 2
 VICTIM_LOAD_ADDR = 0xcafebabe123
 VICTIM_BUFFER_ADDR = 0xaabeef000
-BASE_FLAGS = ["-DEVAL"]
+BASE_FLAGS = ["-DEVAL"] + (["-DUSE_JIT"] if JIT else [])
 
 BITS = 47
 
@@ -1,9 +1,12 @@
 #include "tests/common.h"
+#include "tests/trial.h"
 
 #define MAX(a, b) (a > b ? a : b)
 
 #ifdef ACCESS_MEMORY
-    #define DUMMY_BUFFER_SIZE (PAGE_SIZE * 10)
+    #ifndef DUMMY_BUFFER_SIZE
+        #define DUMMY_BUFFER_SIZE (PAGE_SIZE * 10)
+    #endif /* DUMMY_BUFFER_SIZE */
     static uint8_t* dummy_buffer;
 #endif /* ACCESS_MEMORY */
 
@@ -11,9 +14,11 @@ static uint8_t* colliding_buffer;
 
 static uint64_t prefetch(int64_t stride, int accesses, uint64_t start_offset, uint64_t access_offset, uint64_t measure_offset) {
     
+    uint64_t trace = trace_begin();
     victim_flush_buffer();
 
     mfence();
+    trace_end(TRACE_FLUSH, trace);
     
     #ifdef ACCESS_MEMORY
         // some CPUs seem to only prefetch if there is a lot of memory accesses recently
@@ -26,23 +31,28 @@ static uint64_t prefetch(int64_t stride, int accesses, uint64_t start_offset, ui
     #endif /* USE_NOP */
     
     
-    // repeating 5 times is not necessary, but there is no reason not to (and it may increase chance of success)
-    for(int repeat = 0; repeat < 5; repeat ++) {
+    trace = trace_rounds_begin();
+    // repeating PREFETCH_REPEATS (default 5) times is not necessary, but there is no reason not to (and it may increase chance of success)
+    for(int repeat = 0; repeat < PREFETCH_REPEATS; repeat ++) {
         
-        for(int access = 0; access < accesses; access++) {
-            _victim_gadget(colliding_buffer + start_offset + (access % accesses) * stride); // hacky but should allow re-using victim gadget but to access non-victim buffer
-            #ifdef USE_FENCE
-                mfence();
-            #endif /* USE_FENCE */
-        }
+        uint64_t round = trace_round_begin();
+        // hacky but should allow re-using victim gadget but to access non-victim buffer
+        CORE_TRAIN(accesses, access, _victim_gadget(colliding_buffer + start_offset + access * stride); train_fence());
+        trace_round_end(TRACE_TRAIN, round);
         
+        round = trace_round_begin();
         victim_load_gadget(access_offset);
         #ifdef USE_FENCE
             mfence();
         #endif /* USE_FENCE */
+        trace_round_end(TRACE_TRIGGER, round);
     }
+    trace_rounds_end(trace);
     
-    return victim_probe(measure_offset);
+    trace = trace_begin();
+    uint64_t time = victim_probe(measure_offset);
+    trace_end(TRACE_PROBE, trace);
+    return time;
 }
 
 
@@ -73,6 +83,8 @@ int main(int argc, char** argv) {
         FATAL("usage %s <stride> <accesses> <start_offset> <access_offset> <measure_offset> <colliding_buffer_and> <colliding_buffer_xor> <repeats>\n", argv[0]);
     }
     
+    env_setup();
+    
     if(time_init()) {
         FATAL("failed to initialize timer!\n");
     }
@@ -118,11 +130,14 @@ int main(int argc, char** argv) {
     
     INFO("threshold: %zu\n", threshold);
     
-    int hits = 0;
-    for(int repeat = 0; repeat < repeats; repeat ++) {
-        hits += prefetch(stride, accesses, start_offset, access_offset, measure_offset) < threshold;
+    struct trial_tracker tracker;
+    if(trial_init(&tracker, threshold)) {
+        FATAL("failed to initialize trials!\n");
     }
+    
+    int hits = trial_runs(&tracker, repeats, prefetch(stride, accesses, start_offset, access_offset, measure_offset));
     RESULT("%d\n", hits);
+    trial_report(&tracker);
     
     // munmap(colliding_buffer, VICTIM_BUFFER_SIZE);
     
@@ -1,11 +1,14 @@
 #include "tests/common.h"
+#include "tests/trial.h"
 #include <unistd.h>
 
 #define MAX(a, b) (a > b ? a : b)
 #define MIN(a, b) (a > b ? b : a)
 
 #ifdef ACCESS_MEMORY
-    #define DUMMY_BUFFER_SIZE (PAGE_SIZE * 10)
+    #ifndef DUMMY_BUFFER_SIZE
+        #define DUMMY_BUFFER_SIZE (PAGE_SIZE * 10)
+    #endif /* DUMMY_BUFFER_SIZE */
     static uint8_t* dummy_buffer;
 #endif /* ACCESS_MEMORY */
 
@@ -25,31 +28,38 @@ static uint64_t prefetch(int64_t stride, int accesses, int aligned, int flush_al
     
     uint64_t start = aligned ? 0 : 2 * stride;  // 根据是否对齐设置起始偏移量，如果对齐则从0开始，否则从2倍步长开始
     
+    uint64_t trace = trace_begin();
     if(flush_all) {
         victim_flush_buffer();  // 如果flush_all为真，则刷新整个受害者缓冲区（清空缓存）
     } else {
         victim_flush_single(aligned ? (accesses + 1) * stride : stride);    // 否则，只刷新单个缓存行，具体地址根据是否对齐和访问次数确定
     }
     mfence();
+    trace_end(TRACE_FLUSH, trace);
+    trace = trace_begin();
     prefetch_time = get_time_ns();
     mfence();   
     
     for(register int k = 0; k < 2; k++) {
-        for(register int i = 0; i < accesses; i++) {
-            mfence();
-            colliding_load(colliding_buffer + start + i * stride);  // 调用colliding_load函数，访问colliding_buffer中特定偏移量的数据
-        }
+        // 调用colliding_load函数，访问colliding_buffer中特定偏移量的数据
+        CORE_TRAIN(accesses, i, mfence(); colliding_load(colliding_buffer + start + i * stride));
     }
     
     mfence();
     gadget_time = get_time_ns();
     mfence();
     prefetch_time = gadget_time - prefetch_time;
+    trace_end(TRACE_TRAIN, trace);
+    trace = trace_begin();
     victim_load_gadget(aligned ? accesses * stride : 0);    // 调用受害者的加载小工具，加载特定偏移量的数据，用于触发预取
     mfence();
     gadget_time = get_time_ns() - gadget_time;
+    trace_end(TRACE_TRIGGER, trace);
         
-    return victim_probe(aligned ? (accesses + 1) * stride : stride);
+    trace = trace_begin();
+    uint64_t time = victim_probe(aligned ? (accesses + 1) * stride : stride);
+    trace_end(TRACE_PROBE, trace);
+    return time;
 }
 
 
@@ -80,6 +90,8 @@ int main(int argc, char** argv) {
         FATAL("usage %s <stride> <accesses> <aligned> <colliding_buffer_address_and> <colliding_buffer_address_xor> <colliding_load_address_and> <colliding_load_address_xor> <flush_all> <repeats>\n", argv[0]);
     }
     
+    env_setup();
+    
     if(time_init()) {
         FATAL("failed to initialize timer!\n");
     }
@@ -164,16 +176,19 @@ int main(int argc, char** argv) {
     
     uint64_t threshold = calculate_threshold();
     
-    int hits = 0;
-    for(int i = 0; i < repeats; i++) {
-        hits += prefetch((rand64() % 2048) + 512, accesses, aligned, flush_all) < threshold;
+    struct trial_tracker tracker;
+    if(trial_init(&tracker, threshold)) {
+        FATAL("failed to initialize trials!\n");
     }
     
+    int hits = trial_runs(&tracker, repeats, prefetch((rand64() % 2048) + 512, accesses, aligned, flush_all));
+    
     INFO("threshold: %zu\n", threshold);
     RESULT("setup_time: %zu\n", setup_end - setup_start);
     RESULT("hits: %d\n", hits);
     RESULT("prefetch_time: %zu\n", prefetch_time);
     RESULT("gadget_time: %zu\n", gadget_time);
+    trial_report(&tracker);
     
     time_destroy();
     victim_destroy();
@@ -1,3 +1,4 @@
+import os
 import param_utils
 import plot_utils
 import run_utils
@@ -14,11 +15,25 @@ CORES = sys.argv[1]
 TIMER = sys.argv[2]
 VICTIM = sys.argv[3]
 
+# SL_INPROCESS=1 runs the cells in this process through libstride_re.so (lib_utils) instead of one test_prefetch_simple
+# process per cell. Same trial and the same 100 trials per cell, but calibrated only once per flag set.
+INPROCESS = os.environ.get("SL_INPROCESS") == "1"
+library = None
+
 def comp(TIMER, VICTIM, FLAGS):
-    global CORES
+    global CORES, library
+    if INPROCESS:
+        import lib_utils
+        if library:
+            library.close()
+        library = lib_utils.StrideRE(TIMER, VICTIM, FLAGS, CORES)
+        return
     run_utils.comp("test_prefetch_simple", TIMER, VICTIM, FLAGS, CORES)
     
 def run(stride, accesses, start_offset, access_offset, measure_offset, cores=CORES):
+    if INPROCESS:
+        hits, _, _ = library.run(stride, accesses, start_offset, access_offset, measure_offset, 100)
+        return run_utils.RunResult(0, [], [], [], [], [], [str(hits)])
     arguments = [str(stride), str(accesses), str(start_offset), str(access_offset), str(measure_offset)]
     return run_utils.run("test_prefetch_simple", arguments, cores=cores)
 
@@ -0,0 +1,69 @@
+import atexit
+import contextlib
+import glob
+import json
+import os
+import sys
+import threading
+import time
+
+# tracing of the Python driver, the counterpart of common/trace.h.
+# With SL_TRACE=<directory>, the driver writes <directory>/trace_<pid>.json next to the traces of the harness binaries
+# it starts (they inherit SL_TRACE). Both use CLOCK_MONOTONIC, so
+#
+#   python3 trace_utils.py <directory>
+#
+# merges everything into <directory>/trace.json, one sweep on one timeline (chrome://tracing or ui.perfetto.dev).
+
+DIRECTORY = os.environ.get("SL_TRACE")
+
+_events = []
+_lock = threading.Lock()
+
+def enabled():
+    return bool(DIRECTORY)
+
+@contextlib.contextmanager
+def phase(name, **args):
+    if not enabled():
+        yield
+        return
+    start = time.monotonic_ns()
+    try:
+        yield
+    finally:
+        end = time.monotonic_ns()
+        event = {"name": name, "cat": "driver", "ph": "X", "ts": start / 1000, "dur": (end - start) / 1000, "pid": os.getpid(), "tid": threading.get_ident()}
+        if args:
+            event["args"] = args
+        with _lock:
+            _events.append(event)
+
+def _write():
+    metadata = {"name": "process_name", "ph": "M", "pid": os.getpid(), "args": {"name": os.path.basename(sys.argv[0])}}
+    with open(os.path.join(DIRECTORY, f"trace_{os.getpid()}.json"), "w") as out:
+        json.dump({"displayTimeUnit": "ns", "traceEvents": [metadata] + _events}, out)
+
+def merge(directory):
+    events = []
+    for name in sorted(glob.glob(os.path.join(directory, "trace_*.json"))):
+        try:
+            with open(name) as f:
+                events += json.load(f)["traceEvents"]
+        except (OSError, ValueError, KeyError):
+            print(f"skipping broken trace {name}")
+    output = os.path.join(directory, "trace.json")
+    with open(output, "w") as out:
+        json.dump({"displayTimeUnit": "ns", "traceEvents": events}, out)
+    return output, len(events)
+
+if enabled():
+    os.makedirs(DIRECTORY, exist_ok=True)
+    atexit.register(_write)
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print(f"usage: python3 {sys.argv[0]} <trace directory>")
+        sys.exit(1)
+    output, count = merge(sys.argv[1])
+    print(f"merged {count} events into {output}")
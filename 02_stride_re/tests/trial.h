@@ -0,0 +1,370 @@
+#ifndef TRIAL_H
+#define TRIAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "log.h"
+#include "victim.h"
+#include "uarch.h"
+
+// the threshold from calculate_threshold drifts over long sweeps (frequency, temperature, co-runners).
+// The trial engine therefore interleaves a known-hit and a known-miss canary probe every TRIAL_CANARY_RATE trials,
+// tracks both with an EWMA and moves the threshold along. Trials classified while the canaries could not be
+// separated are counted and reported as "unseparable" after the results of a cell.
+
+// canary probes every n trials (0 disables canaries, the threshold then stays fixed)
+#ifndef TRIAL_CANARY_RATE
+    #define TRIAL_CANARY_RATE 10
+#endif /* TRIAL_CANARY_RATE */
+
+// weight of a new canary in the EWMA
+#ifndef TRIAL_EWMA_WEIGHT
+    #define TRIAL_EWMA_WEIGHT 0.05
+#endif /* TRIAL_EWMA_WEIGHT */
+
+// canaries taken by trial_init to seed the EWMA
+#define TRIAL_CANARY_SEED 32
+
+// canary pairs trial_init tries before it gives up (e.g. every probe is an outlier because the timer is broken)
+#ifndef TRIAL_CANARY_SEED_ATTEMPTS
+    #define TRIAL_CANARY_SEED_ATTEMPTS (100 * TRIAL_CANARY_SEED)
+#endif /* TRIAL_CANARY_SEED_ATTEMPTS */
+
+// a trial is also rejected (and retried) if it was disturbed: it took longer than TRIAL_JUMP_FACTOR times the usual
+// trial duration, or the context-switch / page-fault counters changed. After TRIAL_MAX_RETRIES retries the trial is
+// taken anyway, so a hopeless machine still terminates.
+// For the kernel victim, the interrupt count of our core is checked per batch of TRIAL_BATCH trials instead (reading
+// /proc/interrupts costs far more than a trial): a batch that saw an interrupt is discarded and re-run, again at most
+// TRIAL_MAX_RETRIES times.
+#ifndef TRIAL_JUMP_FACTOR
+    #define TRIAL_JUMP_FACTOR 4
+#endif /* TRIAL_JUMP_FACTOR */
+
+#ifndef TRIAL_MAX_RETRIES
+    #define TRIAL_MAX_RETRIES 10
+#endif /* TRIAL_MAX_RETRIES */
+
+// kernel victim trials spend their time in ioctls, where interrupts are not visible as context switches
+#ifndef TRIAL_GUARD_INTERRUPTS
+    #ifdef STRIDE_RE_MODULE_DEVICE_PATH
+        #define TRIAL_GUARD_INTERRUPTS 1
+    #else
+        #define TRIAL_GUARD_INTERRUPTS 0
+    #endif /* STRIDE_RE_MODULE_DEVICE_PATH */
+#endif /* TRIAL_GUARD_INTERRUPTS */
+
+#ifndef TRIAL_BATCH
+    #define TRIAL_BATCH 10
+#endif /* TRIAL_BATCH */
+
+struct trial_tracker {
+    // EWMA of canary latencies and of their absolute deviation
+    double hit, hit_deviation;
+    double miss, miss_deviation;
+    uint64_t threshold;
+    uint64_t initial_threshold;
+    uint64_t trials;
+    int separable;
+    int unseparable;
+
+    // trial guard
+    int rejected;
+    int retries;
+    int rejected_batches;
+    int batch_retries;
+    int batch_unseparable;
+    double duration;
+    int perf_fd;
+    int interrupt_column;
+    uint64_t start, counters[3], interrupts;
+};
+
+static void trial_ewma(double* mean, double* deviation, uint64_t sample) {
+    double difference = (double) sample - *mean;
+    *mean += TRIAL_EWMA_WEIGHT * difference;
+    *deviation += TRIAL_EWMA_WEIGHT * ((difference < 0 ? -difference : difference) - *deviation);
+}
+
+static void trial_canary(struct trial_tracker* tracker) {
+    // same offset as calculate_threshold, prefetch() flushes the victim buffer before every trial anyway
+    uint64_t offset = VICTIM_BUFFER_SIZE / 2;
+
+    victim_probe(offset);
+    uint64_t hit = victim_probe(offset);
+
+    victim_flush_buffer();
+    mfence();
+    uint64_t miss = victim_probe(offset);
+
+    // ignore outliers (interrupts, etc.) like calculate_threshold
+    if(hit && hit < 1000) {
+        trial_ewma(&tracker->hit, &tracker->hit_deviation, hit);
+    }
+    if(miss && miss < 1000) {
+        trial_ewma(&tracker->miss, &tracker->miss_deviation, miss);
+    }
+
+    // same placement as calculate_threshold: closer to cache hit, but above it
+    if(tracker->miss > tracker->hit) {
+        uint64_t threshold = tracker->hit + (tracker->miss - tracker->hit) / 5;
+        tracker->threshold = threshold > tracker->hit ? threshold : (uint64_t) tracker->hit + 1;
+    }
+
+    // the canaries are separable as long as both distributions stay on their side of the threshold
+    tracker->separable = tracker->hit + tracker->hit_deviation < tracker->threshold && tracker->miss - tracker->miss_deviation >= tracker->threshold;
+}
+
+// context switches and page faults of this process in a single read (perf software events cannot be read with rdpmc)
+static int trial_open_counters(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.size = sizeof(attr);
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+    int leader = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if(leader < 0) {
+        return -1;
+    }
+    attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+    if(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0) < 0) {
+        close(leader);
+        return -1;
+    }
+    return leader;
+}
+
+// reads { number of counters, context switches, page faults }, zeros if the counters are not available
+static void trial_read_counters(struct trial_tracker* tracker, uint64_t counters[3]) {
+    if(tracker->perf_fd < 0 || read(tracker->perf_fd, counters, 3 * sizeof(uint64_t)) != 3 * sizeof(uint64_t)) {
+        memset(counters, 0, 3 * sizeof(uint64_t));
+    }
+}
+
+// column of the current core in /proc/interrupts (-1 if not found)
+static int trial_interrupt_column(void) {
+    FILE* file = fopen("/proc/interrupts", "r");
+    if(!file) {
+        return -1;
+    }
+    char* line = NULL;
+    size_t size = 0;
+    int column = -1;
+    if(getline(&line, &size, file) > 0) {
+        char name[32];
+        snprintf(name, sizeof(name), "CPU%d", sched_getcpu());
+        int index = 0;
+        for(char* token = strtok(line, " \t\n"); token; token = strtok(NULL, " \t\n"), index ++) {
+            if(!strcmp(token, name)) {
+                column = index;
+                break;
+            }
+        }
+    }
+    free(line);
+    fclose(file);
+    return column;
+}
+
+// sum of all interrupts delivered to the core so far
+static uint64_t trial_read_interrupts(struct trial_tracker* tracker) {
+    if(tracker->interrupt_column < 0) {
+        return 0;
+    }
+    FILE* file = fopen("/proc/interrupts", "r");
+    if(!file) {
+        return 0;
+    }
+    char* line = NULL;
+    size_t size = 0;
+    uint64_t sum = 0;
+    // skip header
+    getline(&line, &size, file);
+    while(getline(&line, &size, file) > 0) {
+        char* position = strchr(line, ':');
+        if(!position) {
+            continue;
+        }
+        position ++;
+        for(int column = 0; column <= tracker->interrupt_column; column ++) {
+            char* end;
+            uint64_t count = strtoull(position, &end, 10);
+            if(end == position) {
+                break;
+            }
+            if(column == tracker->interrupt_column) {
+                sum += count;
+            }
+            position = end;
+        }
+    }
+    free(line);
+    fclose(file);
+    return sum;
+}
+
+static void trial_begin(struct trial_tracker* tracker) {
+    trial_read_counters(tracker, tracker->counters);
+    tracker->start = timestamp();
+}
+
+// returns whether the trial has to be repeated
+static int trial_reject(struct trial_tracker* tracker) {
+    uint64_t duration = timestamp() - tracker->start;
+    uint64_t counters[3];
+    trial_read_counters(tracker, counters);
+
+    int disturbed = counters[1] != tracker->counters[1] || counters[2] != tracker->counters[2];
+    // the first trial has nothing to compare against and only sets the usual duration
+    disturbed |= tracker->duration > 0 && duration > TRIAL_JUMP_FACTOR * tracker->duration;
+
+    if(disturbed && tracker->retries < TRIAL_MAX_RETRIES) {
+        tracker->rejected ++;
+        tracker->retries ++;
+        return 1;
+    }
+    tracker->retries = 0;
+    tracker->duration = tracker->duration > 0 ? tracker->duration + TRIAL_EWMA_WEIGHT * (duration - tracker->duration) : duration;
+    return 0;
+}
+
+static void trial_batch_begin(struct trial_tracker* tracker) {
+    tracker->batch_unseparable = tracker->unseparable;
+    #if TRIAL_GUARD_INTERRUPTS
+    tracker->interrupts = trial_read_interrupts(tracker);
+    #endif /* TRIAL_GUARD_INTERRUPTS */
+}
+
+// returns whether the batch has to be repeated (its trials no longer count as unseparable then)
+static int trial_batch_reject(struct trial_tracker* tracker) {
+    #if TRIAL_GUARD_INTERRUPTS
+    if(trial_read_interrupts(tracker) != tracker->interrupts && tracker->batch_retries < TRIAL_MAX_RETRIES) {
+        tracker->unseparable = tracker->batch_unseparable;
+        tracker->rejected_batches ++;
+        tracker->batch_retries ++;
+        return 1;
+    }
+    #endif /* TRIAL_GUARD_INTERRUPTS */
+    tracker->batch_retries = 0;
+    return 0;
+}
+
+// returns 0 on success, -1 if the canaries could not be seeded
+static int trial_init(struct trial_tracker* tracker, uint64_t threshold) {
+    tracker->threshold = tracker->initial_threshold = threshold;
+    tracker->trials = 0;
+    tracker->unseparable = 0;
+    tracker->separable = 1;
+
+    tracker->rejected = 0;
+    tracker->retries = 0;
+    tracker->rejected_batches = 0;
+    tracker->batch_retries = 0;
+    tracker->duration = 0;
+    tracker->perf_fd = trial_open_counters();
+    if(tracker->perf_fd < 0) {
+        DEBUG("no context-switch / page-fault counters, trials are only guarded by their duration\n");
+    }
+    tracker->interrupt_column = TRIAL_GUARD_INTERRUPTS ? trial_interrupt_column() : -1;
+
+    #if TRIAL_CANARY_RATE
+    // seed with the plain mean of the first canaries, the EWMA takes over afterwards
+    uint64_t offset = VICTIM_BUFFER_SIZE / 2;
+    uint64_t hit = 0, miss = 0;
+    int hits = 0, misses = 0;
+    for(int attempt = 0; hits < TRIAL_CANARY_SEED || misses < TRIAL_CANARY_SEED; attempt ++) {
+        if(attempt == TRIAL_CANARY_SEED_ATTEMPTS) {
+            ERROR("only %d hit and %d miss canaries of %d in %d attempts, cannot seed the threshold tracking\n", hits, misses, TRIAL_CANARY_SEED, attempt);
+            if(tracker->perf_fd >= 0) {
+                close(tracker->perf_fd);
+            }
+            return -1;
+        }
+        victim_probe(offset);
+        uint64_t time = victim_probe(offset);
+        if(hits < TRIAL_CANARY_SEED && time && time < 1000) {
+            hit += time;
+            hits ++;
+        }
+        victim_flush_buffer();
+        mfence();
+        time = victim_probe(offset);
+        if(misses < TRIAL_CANARY_SEED && time && time < 1000) {
+            miss += time;
+            misses ++;
+        }
+    }
+    tracker->hit = (double) hit / TRIAL_CANARY_SEED;
+    tracker->miss = (double) miss / TRIAL_CANARY_SEED;
+    tracker->hit_deviation = tracker->miss_deviation = 0;
+    tracker->separable = tracker->hit < threshold && tracker->miss >= threshold;
+    #endif /* TRIAL_CANARY_RATE */
+    return 0;
+}
+
+// returns whether the measured time of a trial is a cache hit
+static int trial_hit(struct trial_tracker* tracker, uint64_t time) {
+    int hit = time < tracker->threshold;
+    tracker->unseparable += !tracker->separable;
+
+    #if TRIAL_CANARY_RATE
+    if(!(++tracker->trials % TRIAL_CANARY_RATE)) {
+        trial_canary(tracker);
+    }
+    #endif /* TRIAL_CANARY_RATE */
+
+    return hit;
+}
+
+// runs (and re-runs) a measurement until it was not disturbed and classifies its result, see trial_hit
+#define trial_run(tracker, measurement) ({ \
+    uint64_t _trial_time; \
+    do { \
+        trial_begin(tracker); \
+        _trial_time = (measurement); \
+    } while(trial_reject(tracker)); \
+    trial_hit(tracker, _trial_time); \
+})
+
+// runs count trials of a measurement in batches of TRIAL_BATCH (see trial_batch_reject) and returns the number of hits
+#define trial_runs(tracker, count, measurement) ({ \
+    int _trial_hits = 0; \
+    for(int _trial_done = 0; _trial_done < (count);) { \
+        int _trial_size = (count) - _trial_done < TRIAL_BATCH ? (count) - _trial_done : TRIAL_BATCH; \
+        int _trial_batch_hits; \
+        do { \
+            trial_batch_begin(tracker); \
+            _trial_batch_hits = 0; \
+            for(int _trial = 0; _trial < _trial_size; _trial ++) { \
+                _trial_batch_hits += trial_run(tracker, measurement); \
+            } \
+        } while(trial_batch_reject(tracker)); \
+        _trial_hits += _trial_batch_hits; \
+        _trial_done += _trial_size; \
+    } \
+    _trial_hits; \
+})
+
+// call after the results of a cell
+static void trial_report(struct trial_tracker* tracker) {
+    DEBUG("threshold drift: %zu -> %zu (hit %.1f +- %.1f, miss %.1f +- %.1f)\n", tracker->initial_threshold, tracker->threshold, tracker->hit, tracker->hit_deviation, tracker->miss, tracker->miss_deviation);
+    if(tracker->unseparable) {
+        WARN("%d trials measured while hit and miss canaries were not separable\n", tracker->unseparable);
+    }
+    RESULT("unseparable: %d\n", tracker->unseparable);
+    RESULT("rejected: %d\n", tracker->rejected);
+    #if TRIAL_GUARD_INTERRUPTS
+    RESULT("rejected_batches: %d\n", tracker->rejected_batches);
+    #endif /* TRIAL_GUARD_INTERRUPTS */
+    if(tracker->perf_fd >= 0) {
+        close(tracker->perf_fd);
+    }
+}
+
+#endif /* TRIAL_H */
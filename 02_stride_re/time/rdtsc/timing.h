@@ -1,10 +1,11 @@
 #ifndef TIME_H
 #define TIME_H
 
-#include <x86intrin.h>
+// timer policy (rdtsc / rdtscp / rdpru) is selected in common/core.h via CORE_TIMER
+#include "uarch.h"
 
 #define time_init() 0
 #define time_destroy() ;
-#define timestamp() __rdtsc()
+#define timestamp() core_timestamp()
 
 #endif /* TIME_H */
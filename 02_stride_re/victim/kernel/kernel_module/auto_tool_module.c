@@ -1,24 +1,192 @@
+#include <linux/bitops.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/slab.h>
+#include <linux/topology.h>
 #include <linux/uaccess.h>
 
+#ifdef __x86_64__
+#include <asm/nospec-branch.h>
+#endif /* __x86_64__ */
+
 #include "auto_tool_module.h"
 
 MODULE_AUTHOR("Redacted");
 MODULE_DESCRIPTION("StrideRE Kernel Module");
 MODULE_LICENSE("GPL");
 
-static uint8_t* kernel_buffer;
+#define _STR(x) #x
+#define STR(x) _STR(x)
+
+// every open file gets its own victim buffer and its own load gadget, so concurrent sweeps on different cores
+// never flush or probe each other's lines and never share a load PC
+struct stride_re_context {
+  uint8_t* buffer;
+  int slot;
+  // currently selected gadget of the farm (defaults to the gadget of the slot) and its index
+  void* gadget;
+  uint64_t index;
+};
+
+// slot_lock protects the slots and the ownership of the farm gadgets, a gadget is used by at most one context
+static DEFINE_MUTEX(slot_lock);
+static DECLARE_BITMAP(used_slots, STRIDE_RE_MAX_CONTEXTS);
+static DECLARE_BITMAP(used_gadgets, STRIDE_RE_FARM_INDICES);
+
+/* gadget farm */
+
+// indirect call targets need a landing pad if the kernel enforces it
+#if defined(__x86_64__) && defined(CONFIG_X86_KERNEL_IBT)
+#define GADGET_LANDING_PAD "endbr64\n"
+#define GADGET_LOAD_OFFSET 4
+#elif defined(__aarch64__) && defined(CONFIG_ARM64_BTI_KERNEL)
+#define GADGET_LANDING_PAD "hint #34\n" /* bti c */
+#define GADGET_LOAD_OFFSET 4
+#else
+#define GADGET_LANDING_PAD ""
+#define GADGET_LOAD_OFFSET 0
+#endif /* LANDING PAD */
+
+#ifdef __x86_64__
+#define GADGET_ASM "mov (%rdi), %rax\n ret\n"
+#define GADGET_FILL "0xcc" /* int3 */
+#else // aarch64
+#define GADGET_ASM "ldr x0, [x0]\n ret\n"
+#define GADGET_FILL "0" /* udf */
+#endif /* ARCHITECTURE */
+
+// STRIDE_RE_FARM_PAGES pages of identical gadgets, one every GADGET_FARM_GRANULE bytes.
+// The gadgets of page p are shifted by p * GADGET_FARM_MISALIGN % 8 bytes (see stride_re_farm_offset)
+asm(
+    ".pushsection .text\n"
+    ".balign " STR(GADGET_FARM_PAGE) "\n"
+    ".global __gadget_farm\n"
+    "__gadget_farm:\n"
+    ".irp page, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15\n"
+    ".balign " STR(GADGET_FARM_PAGE) "\n"
+    ".rept " STR(GADGET_FARM_PER_PAGE) "\n"
+    ".balign " STR(GADGET_FARM_GRANULE) "\n"
+    ".if (\\page * " STR(GADGET_FARM_MISALIGN) ") % 8\n"
+    ".skip (\\page * " STR(GADGET_FARM_MISALIGN) ") % 8\n"
+    ".endif\n"
+    GADGET_LANDING_PAD
+    GADGET_ASM
+    ".endr\n"
+    ".endr\n"
+    ".popsection\n"
+);
+
+// bit gadgets: __gadget_bits_base is page aligned, so bits below 12 are clear and the gadget for such a bit k sits at
+// base + 2^k. Bit k >= 12 of the base is only known after loading, so there are gadgets at base + 2^k and base - 2^k
+// and farm_gadget() picks the one that equals base ^ 2^k
+asm(
+    ".pushsection .text\n"
+    ".balign " STR(GADGET_FARM_PAGE) "\n"
+    "__gadget_bits:\n"
+    ".set stride_re_bit, " STR(GADGET_BITS_LAST) "\n"
+    ".rept " STR(GADGET_BITS_LAST) " - 11\n"
+    ".org __gadget_bits + (1 << " STR(GADGET_BITS_LAST) ") - (1 << stride_re_bit), " GADGET_FILL "\n"
+    GADGET_LANDING_PAD
+    GADGET_ASM
+    ".set stride_re_bit, stride_re_bit - 1\n"
+    ".endr\n"
+    ".org __gadget_bits + (1 << " STR(GADGET_BITS_LAST) "), " GADGET_FILL "\n"
+    ".global __gadget_bits_base\n"
+    "__gadget_bits_base:\n"
+    GADGET_LANDING_PAD
+    GADGET_ASM
+    ".set stride_re_bit, " STR(GADGET_BITS_FIRST) "\n"
+    ".rept " STR(GADGET_BITS_LAST) " - " STR(GADGET_BITS_FIRST) " + 1\n"
+    ".org __gadget_bits_base + (1 << stride_re_bit), " GADGET_FILL "\n"
+    GADGET_LANDING_PAD
+    GADGET_ASM
+    ".set stride_re_bit, stride_re_bit + 1\n"
+    ".endr\n"
+    ".popsection\n"
+);
+
+void __gadget_farm(void*);
+void __gadget_bits_base(void*);
+
+_Static_assert(GADGET_FARM_PAGES == 16, "the .irp list of the gadget farm must cover all pages");
+_Static_assert(GADGET_BITS_LAST >= 12 && GADGET_BITS_LAST < 31, "the bit farm needs its gadgets below the base");
+
+static inline void* farm_gadget(uint64_t index) {
+  if(index >= STRIDE_RE_FARM_BASE) {
+    uintptr_t base = (uintptr_t)__gadget_bits_base;
+    return index == STRIDE_RE_FARM_BASE ? (void*)base
+        : (void*)(base ^ (1ull << (index - STRIDE_RE_FARM_BIT(0))));
+  }
+  return (uint8_t*)__gadget_farm + stride_re_farm_offset(index);
+}
+
+static inline uint64_t gadget_slot(int slot) {
+  return slot * (GADGET_SLOT_SIZE / GADGET_FARM_GRANULE);
+}
+
+static inline void call_gadget(void* gadget, void* addr) {
+#ifdef __x86_64__
+  asm volatile(CALL_NOSPEC : ASM_CALL_CONSTRAINT : THUNK_TARGET(gadget), "D" (addr) : "rax", "memory");
+#else // aarch64
+  register void* x0 asm("x0") = addr;
+  asm volatile("blr %1" : "+r" (x0) : "r" (gadget) : "x30", "memory");
+#endif /* ARCHITECTURE */
+}
 
 static int device_open(struct inode *inode, struct file *file) {
+  struct stride_re_context* ctx;
+  
+  ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+  if(!ctx) {
+    return -ENOMEM;
+  }
+  
+  // keep the buffer on the memory node of the CPU that opened the device (the sweep is pinned there)
+  ctx->buffer = kmalloc_node(BUFFER_SIZE, GFP_KERNEL, numa_node_id());
+  if(!ctx->buffer) {
+    kfree(ctx);
+    return -ENOMEM;
+  }
+  
+  // a free slot whose gadget is not selected by another context
+  mutex_lock(&slot_lock);
+  for(ctx->slot = 0; ctx->slot < STRIDE_RE_MAX_CONTEXTS; ctx->slot++) {
+    if(!test_bit(ctx->slot, used_slots) && !test_bit(gadget_slot(ctx->slot), used_gadgets)) {
+      break;
+    }
+  }
+  if(ctx->slot >= STRIDE_RE_MAX_CONTEXTS) {
+    mutex_unlock(&slot_lock);
+    kfree(ctx->buffer);
+    kfree(ctx);
+    return -EBUSY;
+  }
+  set_bit(ctx->slot, used_slots);
+  ctx->index = gadget_slot(ctx->slot);
+  set_bit(ctx->index, used_gadgets);
+  ctx->gadget = farm_gadget(ctx->index);
+  mutex_unlock(&slot_lock);
+  
+  file->private_data = ctx;
+  
   /* Lock module */
   try_module_get(THIS_MODULE);
   return 0;
 }
 
 static int device_release(struct inode *inode, struct file *file) {
+  struct stride_re_context* ctx = file->private_data;
+  
+  mutex_lock(&slot_lock);
+  clear_bit(ctx->slot, used_slots);
+  clear_bit(ctx->index, used_gadgets);
+  mutex_unlock(&slot_lock);
+  
+  kfree(ctx->buffer);
+  kfree(ctx);
+  
   /* Unlock module */
   module_put(THIS_MODULE);
   return 0;
@@ -69,21 +237,35 @@ static inline __attribute__((always_inline)) uint64_t probe(void* addr){
     return end - start;
 }
 
-void __gadget(uint64_t);
-
 static long device_ioctl(struct file *file, unsigned int ioctl_num,
                          unsigned long ioctl_param) {
+  struct stride_re_context* ctx = file->private_data;
+  uint8_t* kernel_buffer = ctx->buffer;
   size_t i;
   
   switch(ioctl_num) {
   
   
   case CMD_GADGET: {
-      #ifdef __x86_64__
-      asm volatile(".global __gadget\n__gadget:\n mov (%0), %%rax" :: "r" (&kernel_buffer[ioctl_param]) : "rax");
-      #else // aarch64
-      asm volatile(".global __gadget\n__gadget:\n ldr x0, [%0]" :: "r" (&kernel_buffer[ioctl_param]) : "x0");
-      #endif /* ARCHITECTURE */
+      call_gadget(READ_ONCE(ctx->gadget), &kernel_buffer[ioctl_param]);
+      break;
+  }
+  
+  case CMD_SELECT_GADGET: {
+      if(ioctl_param >= STRIDE_RE_FARM_INDICES) {
+          return -EINVAL;
+      }
+      // same ownership as the slots: the gadget of the context moves, a gadget of another context is busy
+      mutex_lock(&slot_lock);
+      if(ioctl_param != ctx->index && test_bit(ioctl_param, used_gadgets)) {
+          mutex_unlock(&slot_lock);
+          return -EBUSY;
+      }
+      clear_bit(ctx->index, used_gadgets);
+      set_bit(ioctl_param, used_gadgets);
+      ctx->index = ioctl_param;
+      WRITE_ONCE(ctx->gadget, farm_gadget(ioctl_param));
+      mutex_unlock(&slot_lock);
       break;
   }
   
@@ -103,7 +285,7 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num,
   case CMD_INFO: {
       struct stride_re_kernel_info info;
       info.kernel_buffer = (uintptr_t)kernel_buffer;
-      info.kernel_access = (uintptr_t)__gadget;
+      info.kernel_access = (uintptr_t)READ_ONCE(ctx->gadget) + GADGET_LOAD_OFFSET;
       copy_to_user((void*)ioctl_param, &info, sizeof(info));
       break;
   }
@@ -182,10 +364,8 @@ int init_module(void) {
     return 1;
   }
 
-  kernel_buffer = kmalloc(BUFFER_SIZE, GFP_KERNEL);
-  
-  printk(KERN_INFO "[stride-re] buffer address: 0x%016llx\n", (uint64_t)kernel_buffer);
-  printk(KERN_INFO "[stride-re] gadget address: 0x%016llx\n", (uint64_t)__gadget);
+  printk(KERN_INFO "[stride-re] gadget farm: 0x%016llx (%d gadgets), bit gadgets: 0x%016llx (bits %d-%d)\n",
+         (uint64_t)__gadget_farm, STRIDE_RE_FARM_GADGETS, (uint64_t)__gadget_bits_base, GADGET_BITS_FIRST, GADGET_BITS_LAST);
 
   return 0;
 }
@@ -198,8 +378,6 @@ void cleanup_module(void) {
 
   misc_deregister(&misc_dev);
   
-  kfree(kernel_buffer);
-  
   printk(KERN_INFO "[stride-re] Removed.\n");
 }
 
@@ -4,6 +4,46 @@
 #define BUFFER_SIZE (PAGE_SIZE * 4)
 #define VICTIM_BUFFER_SIZE BUFFER_SIZE
 
+// maximum number of concurrently open files. Each one gets its own buffer and load gadget
+#define STRIDE_RE_MAX_CONTEXTS 16
+
+// distance between the default load gadgets of two contexts
+#define GADGET_SLOT_SIZE 64
+
+// gadget farm: GADGET_FARM_PAGES pages with one identical load gadget every GADGET_FARM_GRANULE bytes.
+// On x86, the gadgets of page p are shifted by p % 8 bytes, so the farm covers every PC alignment (bit 3 of the
+// offset is always clear). Any gadget can be selected as the load of a context with CMD_SELECT_GADGET.
+#define GADGET_FARM_PAGE 4096
+#define GADGET_FARM_PAGES 16
+#define GADGET_FARM_GRANULE 16
+#define GADGET_FARM_PER_PAGE 256
+#define STRIDE_RE_FARM_GADGETS (GADGET_FARM_PAGES * GADGET_FARM_PER_PAGE)
+
+#ifdef __x86_64__
+#define GADGET_FARM_MISALIGN 1
+#else // aarch64 instructions are always 4 byte aligned
+#define GADGET_FARM_MISALIGN 0
+#endif /* ARCHITECTURE */
+
+// offset of gadget index in the farm
+static inline uint64_t stride_re_farm_offset(uint64_t index) {
+    uint64_t page = index / GADGET_FARM_PER_PAGE;
+    return page * GADGET_FARM_PAGE + (index % GADGET_FARM_PER_PAGE) * GADGET_FARM_GRANULE + (page * GADGET_FARM_MISALIGN) % 8;
+}
+
+// bit gadgets for PC sweeps: behind the farm sits a base gadget (index STRIDE_RE_FARM_BASE) and for every bit k in
+// [GADGET_BITS_FIRST, GADGET_BITS_LAST] a gadget whose address differs from the base only in bit k (index
+// STRIDE_RE_FARM_BIT(k)). Bits below GADGET_BITS_FIRST are unreachable, as two gadgets of up to 8 bytes (with landing
+// pad) cannot be 1, 2 or 4 bytes apart. Bits above GADGET_BITS_LAST would need a bit farm larger than its 2^(LAST+1)
+// bytes of module text, and bits 47 and up are the kernel half of the address space anyway.
+#define GADGET_BITS_FIRST 3
+#ifndef GADGET_BITS_LAST
+#define GADGET_BITS_LAST 20
+#endif /* GADGET_BITS_LAST */
+#define STRIDE_RE_FARM_BASE STRIDE_RE_FARM_GADGETS
+#define STRIDE_RE_FARM_BIT(k) (STRIDE_RE_FARM_BASE + 1 + (k) - GADGET_BITS_FIRST)
+#define STRIDE_RE_FARM_INDICES STRIDE_RE_FARM_BIT(GADGET_BITS_LAST + 1)
+
 #define STRIDE_RE_MODULE_DEVICE_NAME "stride_re_module"
 #define STRIDE_RE_MODULE_DEVICE_PATH "/dev/" STRIDE_RE_MODULE_DEVICE_NAME
 
@@ -24,11 +64,15 @@ struct stride_re_kernel_info {
 // flush a single cache line from the cache
 #define CMD_FLUSH_SINGLE  _IOR(STRIDE_RE_MODULE_IOCTL_MAGIC_NUMBER,  5, uint64_t)
 
-// get address of load and buffer
+// get address of load and buffer (of the context of this file)
 #define CMD_INFO   _IOR(STRIDE_RE_MODULE_IOCTL_MAGIC_NUMBER,  3, void*)
 
 // probe provided offset of buffer
 #define CMD_PROBE  _IOR(STRIDE_RE_MODULE_IOCTL_MAGIC_NUMBER,  4, void*)
 
+// use gadget with the provided index of the gadget farm for CMD_GADGET (CMD_INFO reports its address).
+// A gadget belongs to at most one open file at a time, selecting a gadget used by another one fails with EBUSY
+#define CMD_SELECT_GADGET  _IOR(STRIDE_RE_MODULE_IOCTL_MAGIC_NUMBER,  6, uint64_t)
+
 
 #endif /* _STRIDE_RE_MODULE_H */
@@ -1,3 +1,6 @@
+#ifndef VICTIM_H
+#define VICTIM_H
+
 #include <unistd.h>
 
 #include "kernel_module/auto_tool_module.h"
@@ -7,8 +10,17 @@ int module_fd;
 struct stride_re_kernel_info info;
 
 int victim_init(void) {
+    // every open file is its own context (buffer and load gadget), so concurrent sweeps do not interfere
     module_fd = open(STRIDE_RE_MODULE_DEVICE_PATH, O_RDONLY);
-    ioctl(module_fd, CMD_INFO, &info);
+    if(module_fd < 0) {
+        ERROR("failed to open %s (module not loaded or all contexts in use?)\n", STRIDE_RE_MODULE_DEVICE_PATH);
+        return -1;
+    }
+    if(ioctl(module_fd, CMD_INFO, &info)) {
+        ERROR("failed to get context info from kernel module\n");
+        return -1;
+    }
+    return 0;
 }
 
 uintptr_t victim_buffer_address(void) {
@@ -19,6 +31,19 @@ uintptr_t victim_load_address(void) {
     return info.kernel_access;
 }
 
+// use gadget index of the module's gadget farm as victim load (instead of the default gadget of this context).
+// VICTIM_GADGET_FARM_BASE is the reference gadget of the bit gadgets, see auto_tool_module.h
+#define VICTIM_GADGET_FARM STRIDE_RE_FARM_INDICES
+#define VICTIM_GADGET_FARM_BASE STRIDE_RE_FARM_BASE
+
+int victim_select_gadget(uint64_t index) {
+    if(ioctl(module_fd, CMD_SELECT_GADGET, index)) {
+        ERROR("failed to select gadget %zu of the gadget farm\n", index);
+        return -1;
+    }
+    return ioctl(module_fd, CMD_INFO, &info);
+}
+
 void victim_flush_buffer(void) {
     ioctl(module_fd, CMD_FLUSH, 0);
 }
@@ -39,3 +64,5 @@ uint64_t victim_probe(uint64_t offset) {
 void victim_destroy(void) {
     close(module_fd);
 }
+
+#endif /* VICTIM_H */
@@ -0,0 +1,276 @@
+#ifndef VICTIM_H
+#define VICTIM_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "timing.h"
+#include "uarch.h"
+
+// victim in a separate process (and thus a separate address space), pinned to THREAD_CORE.
+// The victim process owns the victim buffer and serves flush / load gadget / probe commands from a ring in shared memory.
+// This gives a cross-address-space victim without the kernel module (no root, no ioctl per step).
+
+#ifndef THREAD_CORE
+    #error "the process victim needs THREAD_CORE (core the victim process is pinned to)"
+#endif /* THREAD_CORE */
+
+// if something else defines size of the victim buffer, we just roll with that
+#ifndef VICTIM_BUFFER_SIZE
+    #define VICTIM_BUFFER_SIZE (PAGE_SIZE * 30)
+#endif /* VICTIM_BUFFER_SIZE */
+
+// must be a power of two
+#define VICTIM_RING_ENTRIES 64
+
+// map_buffer comes from the measurement core, map_load_gadget from tests/common.h
+#ifdef VICTIM_GADGET_ADDRESS
+static load_gadget_f map_load_gadget(uintptr_t address);
+#endif /* VICTIM_GADGET_ADDRESS */
+
+
+#ifdef VICTIM_GADGET_ADDRESS
+    load_gadget_f _victim_gadget;
+#else
+    void _victim_gadget(void*);
+#endif /* VICTIM_GADGET_ADDRESS */
+
+enum victim_command {
+    VICTIM_CMD_FLUSH,
+    VICTIM_CMD_FLUSH_SINGLE,
+    VICTIM_CMD_GADGET,
+    VICTIM_CMD_PROBE
+};
+
+enum victim_state {
+    VICTIM_STATE_STARTING,
+    VICTIM_STATE_READY,
+    VICTIM_STATE_FAILED
+};
+
+struct victim_ring_entry {
+    // entry holds command number n once sequence is n + 1 (written last by the attacker)
+    uint64_t sequence;
+    uint64_t command;
+    uint64_t offset;
+    uint64_t result;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct victim_ring {
+    // written by the victim process only, in their own cache lines so polling does not bounce the entries
+    uint64_t served __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint64_t state __attribute__((aligned(CACHE_LINE_SIZE)));
+    uintptr_t buffer;
+    uintptr_t gadget;
+    struct victim_ring_entry entries[VICTIM_RING_ENTRIES];
+};
+
+static struct victim_ring* victim_ring = NULL;
+
+// number of commands submitted by the attacker
+static uint64_t victim_submitted = 0;
+
+static pid_t victim_pid = -1;
+
+// only valid inside the victim process
+static uint8_t* victim_buffer = NULL;
+
+static inline __attribute__((always_inline)) uint64_t victim_probe_process(uint64_t offset) {
+    register uint64_t start, end;
+    mfence();
+    start = timestamp();
+    mfence();
+    maccess(&victim_buffer[offset]);
+    mfence();
+    end = timestamp();
+    mfence();
+    return end - start;
+}
+
+#ifdef VICTIM_GADGET_ADDRESS
+#define victim_load_gadget_process(offset) _victim_gadget(&victim_buffer[offset])
+#else
+// not naked: the address is computed in C, so the compiler has to emit the prologue and return
+static __attribute__((noinline)) void victim_load_gadget_process(uint64_t offset) {
+    _maccess(
+        ".global _victim_gadget\n"
+        "_victim_gadget:\n",
+        &victim_buffer[offset]
+    );
+}
+#endif /* VICTIM_GADGET_ADDRESS */
+
+static __attribute__((noreturn)) void _victim_process_main(pid_t parent) {
+    // never outlive the attacker
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if(getppid() != parent) {
+        _exit(0);
+    }
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(THREAD_CORE, &cpuset);
+    if(sched_setaffinity(0, sizeof(cpu_set_t), &cpuset)) {
+        ERROR("failed to pin victim process to core %d\n", THREAD_CORE);
+        __atomic_store_n(&victim_ring->state, VICTIM_STATE_FAILED, __ATOMIC_RELEASE);
+        _exit(1);
+    }
+
+    #ifdef VICTIM_BUFFER_ADDRESS
+    victim_buffer = map_buffer(VICTIM_BUFFER_ADDRESS, VICTIM_BUFFER_SIZE);
+    #else
+    victim_buffer = mmap(NULL, VICTIM_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE, -1, 0);
+    if(victim_buffer == MAP_FAILED) {
+        victim_buffer = NULL;
+    }
+    #endif /* VICTIM_BUFFER_ADDRESS */
+    if(!victim_buffer) {
+        ERROR("failed to map victim buffer in victim process!\n");
+        __atomic_store_n(&victim_ring->state, VICTIM_STATE_FAILED, __ATOMIC_RELEASE);
+        _exit(1);
+    }
+
+    // timers that rely on a helper thread (counter_thread) do not survive fork
+    uint64_t start = timestamp();
+    for(int i = 0; i < 100000; i++) nop();
+    if(timestamp() == start) {
+        ERROR("timer does not advance in victim process (thread-based timers are not supported)\n");
+        __atomic_store_n(&victim_ring->state, VICTIM_STATE_FAILED, __ATOMIC_RELEASE);
+        _exit(1);
+    }
+
+    victim_ring->buffer = (uintptr_t) victim_buffer;
+    victim_ring->gadget = (uintptr_t) _victim_gadget;
+    __atomic_store_n(&victim_ring->state, VICTIM_STATE_READY, __ATOMIC_RELEASE);
+
+    for(uint64_t served = 0;; served ++) {
+        struct victim_ring_entry* entry = &victim_ring->entries[served & (VICTIM_RING_ENTRIES - 1)];
+        while(__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) != served + 1);
+
+        switch(entry->command) {
+            case VICTIM_CMD_FLUSH:
+                for(uint64_t offset = 0; offset < VICTIM_BUFFER_SIZE; offset += CACHE_LINE_SIZE) {
+                    flush(&victim_buffer[offset]);
+                }
+                break;
+            case VICTIM_CMD_FLUSH_SINGLE:
+                flush(&victim_buffer[entry->offset]);
+                break;
+            case VICTIM_CMD_GADGET:
+                victim_load_gadget_process(entry->offset);
+                break;
+            case VICTIM_CMD_PROBE:
+                entry->result = victim_probe_process(entry->offset);
+                break;
+        }
+        mfence();
+
+        __atomic_store_n(&victim_ring->served, served + 1, __ATOMIC_RELEASE);
+    }
+}
+
+// returns the ring entry of the submitted command
+static inline __attribute__((always_inline)) struct victim_ring_entry* victim_submit(uint64_t command, uint64_t offset) {
+    // wait for a free entry (only relevant if many commands are posted in a row)
+    while(victim_submitted - __atomic_load_n(&victim_ring->served, __ATOMIC_ACQUIRE) >= VICTIM_RING_ENTRIES);
+
+    struct victim_ring_entry* entry = &victim_ring->entries[victim_submitted & (VICTIM_RING_ENTRIES - 1)];
+    entry->command = command;
+    entry->offset = offset;
+    __atomic_store_n(&entry->sequence, ++victim_submitted, __ATOMIC_RELEASE);
+    return entry;
+}
+
+static inline __attribute__((always_inline)) void victim_wait(void) {
+    while(__atomic_load_n(&victim_ring->served, __ATOMIC_ACQUIRE) != victim_submitted);
+}
+
+static int victim_init(void) {
+    #ifdef VICTIM_GADGET_ADDRESS
+    // mapped before fork, so attacker and victim have the gadget at the same address (like the shared binary)
+    _victim_gadget = map_load_gadget(VICTIM_GADGET_ADDRESS);
+    if(!_victim_gadget) {
+        return -1;
+    }
+    #endif /* VICTIM_GADGET_ADDRESS */
+
+    victim_ring = mmap(NULL, sizeof(struct victim_ring), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED | MAP_POPULATE, -1, 0);
+    if(victim_ring == MAP_FAILED) {
+        ERROR("failed to map victim command ring!\n");
+        return -1;
+    }
+    victim_submitted = 0;
+
+    pid_t parent = getpid();
+    fflush(stdout);
+    victim_pid = fork();
+    if(victim_pid < 0) {
+        ERROR("failed to fork victim process!\n");
+        return -1;
+    }
+    if(!victim_pid) {
+        _victim_process_main(parent);
+    }
+
+    uint64_t state;
+    while((state = __atomic_load_n(&victim_ring->state, __ATOMIC_ACQUIRE)) == VICTIM_STATE_STARTING) {
+        if(waitpid(victim_pid, NULL, WNOHANG) == victim_pid) {
+            state = VICTIM_STATE_FAILED;
+            break;
+        }
+    }
+    if(state != VICTIM_STATE_READY) {
+        ERROR("victim process failed to start\n");
+        waitpid(victim_pid, NULL, 0);
+        return -1;
+    }
+
+    DEBUG("victim process: %d on core %d\n", victim_pid, THREAD_CORE);
+    DEBUG("victim buffer: 0x%016zx\n", victim_ring->buffer);
+    DEBUG("victim load gadget: 0x%016zx\n", victim_ring->gadget);
+    return 0;
+}
+
+static uintptr_t victim_buffer_address(void) {
+    return victim_ring->buffer;
+}
+
+static uintptr_t victim_load_address(void) {
+    return victim_ring->gadget;
+}
+
+// flushes are posted, the ring keeps them ordered before the next gadget / probe
+static void victim_flush_buffer(void) {
+    victim_submit(VICTIM_CMD_FLUSH, 0);
+}
+
+static void victim_flush_single(uint64_t offset) {
+    victim_submit(VICTIM_CMD_FLUSH_SINGLE, offset);
+}
+
+static void victim_load_gadget(uint64_t offset) {
+    victim_submit(VICTIM_CMD_GADGET, offset);
+    victim_wait();
+}
+
+static uint64_t victim_probe(uint64_t offset) {
+    struct victim_ring_entry* entry = victim_submit(VICTIM_CMD_PROBE, offset);
+    victim_wait();
+    return entry->result;
+}
+
+void victim_destroy(void) {
+    kill(victim_pid, SIGKILL);
+    waitpid(victim_pid, NULL, 0);
+    munmap(victim_ring, sizeof(struct victim_ring));
+    #ifdef VICTIM_GADGET_ADDRESS
+    munmap(_victim_gadget, 2 * PAGE_SIZE);
+    #endif /* VICTIM_GADGET_ADDRESS */
+}
+
+#endif /* VICTIM_H */
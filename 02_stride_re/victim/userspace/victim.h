@@ -14,18 +14,11 @@
 
 static uint8_t* victim_buffer = NULL;
 
-#if defined(VICTIM_BUFFER_ADDRESS) || defined(VICTIM_GADGET_ADDRESS)
-
-static uint8_t* map_buffer(uintptr_t address, uint64_t size);
-
+// map_buffer comes from the measurement core, map_load_gadget from tests/common.h
 #ifdef VICTIM_GADGET_ADDRESS
-typedef void (*load_gadget_f)(void*);
-
 static load_gadget_f map_load_gadget(uintptr_t address);
 #endif /* VICTIM_GADGET_ADDRESS */
 
-#endif /* VICTIM_BUFFER_ADDRESS || VICTIM_GADGET_ADDRESS */ 
-
 
 #ifdef VICTIM_GADGET_ADDRESS
     load_gadget_f _victim_gadget;
@@ -92,6 +85,10 @@ static void victim_flush_buffer(void) {
     }
 }
 
+static void victim_flush_single(uint64_t offset) {
+    flush(&victim_buffer[offset]);
+}
+
 #ifdef VICTIM_GADGET_ADDRESS
 #define victim_load_gadget(offset) _victim_gadget(&victim_buffer[offset])
 #else
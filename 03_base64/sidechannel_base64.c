@@ -9,6 +9,7 @@
 #include <time.h>
 
 #include "common.h"
+#include "env.h"
 
 // colliding load instruction
 static load_gadget_f gadget;
@@ -89,6 +90,8 @@ static uint64_t guess_byte(size_t guess_offset, char secret) {
 }
 
 int main(int argc, char** argv) {
+    env_setup();
+
     uint64_t victim_buffer = (uint64_t)base64Decode;
     uint64_t victim_load = (uint64_t)__victim_load;
     
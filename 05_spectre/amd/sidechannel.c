@@ -5,6 +5,7 @@
 #include <time.h>
 
 #include "common.h"
+#include "env.h"
 
 #include "kernel_module/fetch_probe_module.h"
 
@@ -52,6 +53,7 @@ static uint64_t get_time_nanos() {
 }
 
 int main(int argc, char** argv) {
+    env_setup();
 
     // open kernel module
     module_fd = open(FETCH_PROBE_MODULE_DEVICE_PATH, O_RDONLY);
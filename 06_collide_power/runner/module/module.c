@@ -5,6 +5,10 @@
 #include <asm/mwait.h>
 #include <asm/smap.h>
 #include <asm/special_insns.h>
+#include <asm/tsc.h>
+#include <linux/bitops.h>
+#include <linux/capability.h>
+#include <linux/cpumask.h>
 #include <linux/delay.h>
 #include <linux/hrtimer.h>
 #include <linux/irq.h>
@@ -15,13 +19,16 @@
 #include <linux/kprobes.h>
 #include <linux/ktime.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/sched.h>
 #include <linux/signal.h>
 #include <linux/slab.h>
+#include <linux/smp.h>
 #include <linux/types.h>
 #include <linux/uaccess.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
 #include <linux/wait.h>
 
 MODULE_LICENSE("GPL");
@@ -85,10 +92,11 @@ MODULE_VERSION("");
 static long module_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
 static int  module_open(struct inode *, struct file *);
 static int  module_release(struct inode *, struct file *);
+static int  module_mmap(struct file *, struct vm_area_struct *);
 
 typedef unsigned long (*kallsyms_lookup_name_t)(const char *);
 
-static struct file_operations file_ops = { .open = module_open, .release = module_release, .unlocked_ioctl = module_ioctl /*, .mmap = module_mmap*/ };
+static struct file_operations file_ops = { .open = module_open, .release = module_release, .unlocked_ioctl = module_ioctl, .mmap = module_mmap };
 
 static struct miscdevice dev = { .minor = MISC_DYNAMIC_MINOR, .name = TAG, .fops = &file_ops, .mode = S_IRUGO | S_IWUGO };
 
@@ -101,6 +109,12 @@ static uint32_t device_open_count = 0;
 #define WRMSR(_nr, _val) wrmsrl(_nr, _val)
 #define RDMSR(_nr)       __rdmsr(_nr)
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 16, 0)
+#define RDMSR_SAFE(_nr, _val) rdmsrq_safe(_nr, _val)
+#else
+#define RDMSR_SAFE(_nr, _val) rdmsrl_safe(_nr, _val)
+#endif
+
 /********************************************************************************
  * IOCTL
  ********************************************************************************/
@@ -113,14 +127,9 @@ long measure_begin(struct file *filep, unsigned int cmd, unsigned long arg) {
     // while ( energy_start == __rdmsr(ENERGY_PP0) )
     //    ;
 
+    // further registers (e.g. the c-state residencies) come from the MSR descriptor list
     asm volatile(
 
-        /* read c-state residencies*/
-        // PLACE_INTEL(ASM_RDMSR(MSR_CORE_C7_RESIDENCY, c7)) //
-        // PLACE_INTEL(ASM_RDMSR(MSR_CORE_C6_RESIDENCY, c6)) //
-        // PLACE_INTEL(ASM_RDMSR(MSR_CORE_C3_RESIDENCY, c3)) //
-        //  ASM_RDMSR(MSR_CORE_C1_RESIDENCY, c1) //
-
         /* mperf aperf end */
         ASM_RDMSR(MSR_IA32_MPERF, mp) //
         ASM_RDMSR(MSR_IA32_APERF, ap) //
@@ -138,11 +147,7 @@ long measure_begin(struct file *filep, unsigned int cmd, unsigned long arg) {
           [pp0] "=m"(begin->energy_pp0),   //
           [tsc] "=m"(begin->cycles),       //
           [ap] "=m"(begin->aperf),         //
-          [mp] "=m"(begin->mperf)          //,         //
-                                           //[c1] "=m"(begin->c1_residency),  //
-                                           //[c3] "=m"(begin->c3_residency),  //
-                                           //[c6] "=m"(begin->c6_residency),  //
-                                           //[c7] "=m"(begin->c7_residency)   //
+          [mp] "=m"(begin->mperf)          //
         :
         : "rax", "rcx", "rdx");
 
@@ -183,12 +188,6 @@ long measure_end(struct file *filep, unsigned int cmd, unsigned long arg) {
         /* read temperature target */
         PLACE_INTEL(ASM_RDMSR_LOW(MSR_IA32_TEMPERATURE_TARGET, tt)) //
 
-        /* read c-state residencies*/
-        // ASM_RDMSR(MSR_CORE_C1_RESIDENCY, c1) //
-        // PLACE_INTEL(ASM_RDMSR(MSR_CORE_C3_RESIDENCY, c3)) //
-        // PLACE_INTEL(ASM_RDMSR(MSR_CORE_C6_RESIDENCY, c6)) //
-        // PLACE_INTEL(ASM_RDMSR(MSR_CORE_C7_RESIDENCY, c7)) //
-
         : [pkg] "=m"(end.energy_pkg),   //
           [dram] "=m"(end.energy_dram), //
           [pp0] "=m"(end.energy_pp0),   //
@@ -197,11 +196,7 @@ long measure_end(struct file *filep, unsigned int cmd, unsigned long arg) {
           [ap] "=m"(end.aperf),         //
           [mp] "=m"(end.mperf),         //
           [tt] "=m"(therm_target),      //
-          [ts] "=m"(therm_status)       //,      //
-                                        //[c1] "=m"(end.c1_residency),  //
-                                        //[c3] "=m"(end.c3_residency),  //
-                                        //[c6] "=m"(end.c6_residency),  //
-                                        //[c7] "=m"(end.c7_residency)   //
+          [ts] "=m"(therm_status)       //
         :
         : "rax", "rcx", "rdx");
 
@@ -222,21 +217,11 @@ long measure_end(struct file *filep, unsigned int cmd, unsigned long arg) {
     begin->aperf = end.aperf - begin->aperf;
     begin->mperf = end.mperf - begin->mperf;
 
-    // begin->c1_residency = 0; // end.c1_residency - begin->c1_residency;
-    // begin->c3_residency = end.c3_residency - begin->c3_residency;
-    // begin->c6_residency = end.c6_residency - begin->c6_residency;
-    // begin->c7_residency = end.c7_residency - begin->c7_residency;
-
 #if defined(IS_AMD)
     begin->voltage     = 0;
     begin->pstate      = 0;
     begin->energy_dram = 0;
     begin->temperature = 0;
-
-    // begin->c1_residency = 0;
-    // begin->c3_residency = 0;
-    // begin->c6_residency = 0;
-    // begin->c7_residency = 0;
 #endif
 
     return 0;
@@ -253,6 +238,323 @@ long measure_us(struct file *filep, unsigned int cmd, unsigned long arg) {
     return 0;
 }
 
+/********************************************************************************
+ * SAMPLER
+ ********************************************************************************/
+
+// ring shared with user space (header page + slots), allocated on open
+static struct sampler_header *sampler_ring = NULL;
+static struct sample_t       *sampler_samples;
+
+static struct hrtimer sampler_timer;
+static ktime_t        sampler_period;
+static uint32_t       sampler_cpu;
+static bool           sampler_running = false;
+
+// runs in hard irq context on sampler_cpu
+static void sampler_record(void) {
+    struct sampler_header *ring = sampler_ring;
+    struct sample_t       *sample;
+    uint64_t               head = ring->head;
+
+    if ( head - smp_load_acquire(&ring->tail) >= SAMPLER_SLOTS ) {
+        ring->dropped++;
+        return;
+    }
+
+    sample = &sampler_samples[head % SAMPLER_SLOTS];
+
+    sample->tsc         = rdtsc_ordered();
+    sample->aperf       = RDMSR(MSR_IA32_APERF);
+    sample->mperf       = RDMSR(MSR_IA32_MPERF);
+    sample->energy_pkg  = RDMSR(ENERGY_PKG);
+    sample->energy_pp0  = RDMSR(ENERGY_PP0);
+#if !defined(IS_AMD)
+    sample->energy_dram  = RDMSR(ENERGY_DRAM);
+    sample->perf_status  = RDMSR(MSR_IA32_PERF_STATUS);
+    sample->therm_status = RDMSR(MSR_IA32_THERM_STATUS);
+#else
+    sample->energy_dram  = 0;
+    sample->perf_status  = 0;
+    sample->therm_status = 0;
+#endif
+    sample->epoch = READ_ONCE(ring->epoch);
+    sample->cpu   = smp_processor_id();
+
+    // publish the slot only after it is complete
+    smp_store_release(&ring->head, head + 1);
+}
+
+static enum hrtimer_restart sampler_tick(struct hrtimer *timer) {
+    sampler_record();
+    hrtimer_forward_now(timer, sampler_period);
+    return HRTIMER_RESTART;
+}
+
+// pinned hrtimers fire on the cpu that started them
+static void sampler_start_on_cpu(void *unused) {
+    hrtimer_start(&sampler_timer, sampler_period, HRTIMER_MODE_REL_PINNED);
+}
+
+static void sampler_stop(void) {
+    if ( sampler_running ) {
+        hrtimer_cancel(&sampler_timer);
+        sampler_running = false;
+    }
+}
+
+long sampler_start(struct file *filep, unsigned int cmd, unsigned long arg) {
+    struct sampler_config *config = (struct sampler_config *)arg;
+
+    if ( !sampler_ring ) {
+        return -ENOMEM;
+    }
+    if ( config->cpu >= nr_cpu_ids || !cpu_online(config->cpu) ) {
+        return -EINVAL;
+    }
+
+    sampler_stop();
+
+    sampler_period = ns_to_ktime(max_t(uint64_t, config->period_ns, SAMPLER_MIN_PERIOD_NS));
+    sampler_cpu    = config->cpu;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(&sampler_timer, sampler_tick, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+#else
+    hrtimer_init(&sampler_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+    sampler_timer.function = sampler_tick;
+#endif
+
+    sampler_running = true;
+    smp_call_function_single(sampler_cpu, sampler_start_on_cpu, NULL, 1);
+
+    INFO("sampling cpu %u every %llu ns", sampler_cpu, ktime_to_ns(sampler_period));
+    return 0;
+}
+
+long sampler_stop_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+    sampler_stop();
+    return 0;
+}
+
+static int module_mmap(struct file *filp, struct vm_area_struct *vma) {
+    if ( !sampler_ring || vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_ALIGN(SAMPLER_RING_SIZE) ) {
+        return -EINVAL;
+    }
+    return remap_vmalloc_range(vma, sampler_ring, 0);
+}
+
+/********************************************************************************
+ * MSR DESCRIPTOR LIST
+ ********************************************************************************/
+
+// active list, empty until user space uploads one
+static struct msr_list_t msr_list;
+
+// indices into msr_list of the begin and end reads in read order, built once on upload so the reads around the window
+// are a plain loop over registers
+static uint32_t msr_begin_order[MEASURE_MAX_MSRS];
+static uint32_t msr_end_order[MEASURE_MAX_MSRS];
+static uint32_t msr_begin_count;
+static uint32_t msr_end_count;
+
+// raw values of the end reads
+static uint64_t msr_end_raw[MEASURE_MAX_MSRS];
+
+// set once a read of the active list faulted, so the fault is only reported once per upload
+static bool msr_fault_reported;
+
+long msr_list_set(struct file *filep, unsigned int cmd, unsigned long arg) {
+    struct msr_list_t *list = (struct msr_list_t *)arg;
+    uint64_t           value;
+    uint32_t           i;
+
+    if ( list->count > MEASURE_MAX_MSRS ) {
+        return -EINVAL;
+    }
+    for ( i = 0; i < list->count; ++i ) {
+        struct msr_desc_t *desc = &list->desc[i];
+        if ( desc->kind > MSR_KIND_END || desc->shift > 63 || desc->bits > 64 ) {
+            return -EINVAL;
+        }
+        // the device is world accessible, arbitrary MSRs need the same capability as /dev/cpu/*/msr
+        if ( desc->msr != MSR_DESC_TSC && !capable(CAP_SYS_RAWIO) ) {
+            return -EPERM;
+        }
+        // reject registers this cpu does not have, the runner uploads the list from the core that reads it
+        if ( desc->msr != MSR_DESC_TSC && RDMSR_SAFE(desc->msr, &value) ) {
+            ERROR("msr %#x of %.*s is not readable", desc->msr, MSR_NAME_SIZE, desc->name);
+            return -EIO;
+        }
+    }
+
+    msr_list           = *list;
+    msr_fault_reported = false;
+    msr_begin_count = 0;
+    msr_end_count   = 0;
+    for ( i = list->count; i-- > 0; ) {
+        if ( list->desc[i].kind != MSR_KIND_END ) {
+            msr_begin_order[msr_begin_count++] = i;
+        }
+    }
+    for ( i = 0; i < list->count; ++i ) {
+        if ( list->desc[i].kind != MSR_KIND_BEGIN ) {
+            msr_end_order[msr_end_count++] = i;
+        }
+    }
+
+    INFO("%u msr descriptors", list->count);
+    return 0;
+}
+
+// a register can still fault on a cpu other than the one of the upload (hybrid parts), it then reads as 0. Returns the
+// number of faulted reads
+static inline uint32_t msr_list_read(uint32_t const *order, uint32_t count, uint64_t *raw) {
+    uint32_t faults = 0;
+    uint32_t i;
+    for ( i = 0; i < count; ++i ) {
+        uint32_t msr = msr_list.desc[order[i]].msr;
+        if ( msr == MSR_DESC_TSC ) {
+            raw[order[i]] = rdtsc_ordered();
+        } else if ( RDMSR_SAFE(msr, &raw[order[i]]) ) {
+            raw[order[i]] = 0;
+            ++faults;
+        }
+    }
+    return faults;
+}
+
+static inline uint64_t msr_field(struct msr_desc_t const *desc, uint64_t value) {
+    value >>= desc->shift;
+    return desc->bits && desc->bits < 64 ? value & ((1ull << desc->bits) - 1) : value;
+}
+
+// turns the begin reads in values and the end reads in msr_end_raw into the values of the descriptors
+static void msr_list_finish(uint64_t *values) {
+    uint32_t i;
+    for ( i = 0; i < msr_list.count; ++i ) {
+        struct msr_desc_t const *desc = &msr_list.desc[i];
+        switch ( desc->kind ) {
+            case MSR_KIND_DIFF:
+                values[i] = msr_field(desc, msr_field(desc, msr_end_raw[i]) - msr_field(desc, values[i]));
+                break;
+            case MSR_KIND_BEGIN:
+                values[i] = msr_field(desc, values[i]);
+                break;
+            default:
+                values[i] = msr_field(desc, msr_end_raw[i]);
+                break;
+        }
+    }
+}
+
+/********************************************************************************
+ * PER-CPU MEASUREMENT
+ ********************************************************************************/
+
+// runs on every cpu of the mask (IPI, interrupts disabled)
+static void measure_core(void *arg) {
+    struct measurement_cpus_t *data = (struct measurement_cpus_t *)arg;
+    uint32_t                   cpu  = smp_processor_id();
+    struct core_measurement_t *core = &data->cores[hweight64(data->cpu_mask & ((1ull << cpu) - 1))];
+
+    uint64_t cycles = rdtsc_ordered();
+    uint64_t aperf  = RDMSR(MSR_IA32_APERF);
+    uint64_t mperf  = RDMSR(MSR_IA32_MPERF);
+
+    // the first call stores the start values, the second one the differences
+    if ( !core->valid ) {
+        core->cycles = cycles;
+        core->aperf  = aperf;
+        core->mperf  = mperf;
+        core->cpu    = cpu;
+        core->valid  = 1;
+        return;
+    }
+
+    core->cycles = cycles - core->cycles;
+    core->aperf  = aperf - core->aperf;
+    core->mperf  = mperf - core->mperf;
+
+#if !defined(IS_AMD)
+    {
+        uint64_t perf_status  = RDMSR(MSR_IA32_PERF_STATUS);
+        uint64_t therm_status = RDMSR(MSR_IA32_THERM_STATUS);
+        uint64_t therm_target = RDMSR(MSR_IA32_TEMPERATURE_TARGET);
+
+        core->voltage     = ((perf_status & 0xFFFF00000000llu) >> 32);
+        core->pstate      = ((perf_status & 0xFFFFllu) >> 8);
+        core->temperature = ((therm_target >> 16) & 0xFF) - ((therm_status >> 16) & 0x7F);
+    }
+#endif
+}
+
+// longest stretch of a MEASURE_US_CPUS window with preemption disabled (plans allow windows up to 65535 us)
+#define MEASURE_CHUNK_US 1000
+
+// measure_us for a caller that disabled preemption: the delay runs in chunks of MEASURE_CHUNK_US with a preemption
+// point between them, the caller keeps migration disabled so the window stays on one cpu
+static void measure_window(struct file *filep, unsigned int cmd, struct measurement_t *data) {
+    uint64_t left = data->cycles;
+
+    measure_begin(filep, cmd, (unsigned long)data);
+    while ( left ) {
+        uint64_t chunk = min_t(uint64_t, left, MEASURE_CHUNK_US);
+        udelay(chunk);
+        left -= chunk;
+        if ( left ) {
+            preempt_enable();
+            cond_resched();
+            preempt_disable();
+        }
+    }
+    measure_end(filep, cmd, (unsigned long)data);
+}
+
+long measure_us_cpus(struct file *filep, unsigned int cmd, unsigned long arg) {
+    struct measurement_cpus_t *data = (struct measurement_cpus_t *)arg;
+    cpumask_var_t              mask;
+    uint32_t                   cpu;
+    uint32_t                   faults;
+
+    if ( hweight64(data->cpu_mask) > MEASURE_MAX_CPUS ) {
+        return -EINVAL;
+    }
+    if ( !zalloc_cpumask_var(&mask, GFP_KERNEL) ) {
+        return -ENOMEM;
+    }
+    for ( cpu = 0; cpu < 64 && cpu < nr_cpu_ids; ++cpu ) {
+        if ( data->cpu_mask & (1ull << cpu) ) {
+            cpumask_set_cpu(cpu, mask);
+        }
+    }
+    cpumask_and(mask, mask, cpu_online_mask);
+    memset(data->cores, 0, sizeof(data->cores));
+    memset(data->msrs, 0, sizeof(data->msrs));
+
+    // no migration between the two IPIs, the package counters and the descriptor list are read on this cpu. Preemption
+    // is only disabled per chunk of the window (measure_window)
+    migrate_disable();
+    preempt_disable();
+    on_each_cpu_mask(mask, measure_core, data, 1);
+    faults = msr_list_read(msr_begin_order, msr_begin_count, data->msrs);
+    measure_window(filep, cmd, &data->package);
+    faults += msr_list_read(msr_end_order, msr_end_count, msr_end_raw);
+    on_each_cpu_mask(mask, measure_core, data, 1);
+    cpu = smp_processor_id();
+    preempt_enable();
+    migrate_enable();
+    msr_list_finish(data->msrs);
+
+    if ( faults && !msr_fault_reported ) {
+        ERROR("%u msr reads faulted on cpu %u, their values are 0", faults, cpu);
+        msr_fault_reported = true;
+    }
+
+    free_cpumask_var(mask);
+    return 0;
+}
+
 #define TIMEOUT_NSEC (1000000L) // 1 ms
 #define TIMEOUT_SEC  (0)        //
 
@@ -261,11 +563,12 @@ typedef long (*module_ioc_t)(struct file *filep, unsigned int cmd, unsigned long
 //                                                         %rdi, %rsi, %rdx, %r10, %r8 and %r9.
 static long module_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
 
-    char         data[256];
+    char         small[256];
+    char        *data    = small;
     module_ioc_t handler = NULL;
     long         ret;
 
-    if ( _IOC_SIZE(cmd) > 256 ) {
+    if ( _IOC_SIZE(cmd) > 4096 ) {
         return -EFAULT;
     }
 
@@ -275,20 +578,50 @@ static long module_ioctl(struct file *filep, unsigned int cmd, unsigned long arg
             handler = measure_us;
             break;
 
+        case MEASURE_US_CPUS:
+            handler = measure_us_cpus;
+            break;
+
+        case MSR_LIST_SET:
+            handler = msr_list_set;
+            break;
+
+        case SAMPLER_START:
+            handler = sampler_start;
+            break;
+
+        case SAMPLER_STOP:
+            handler = sampler_stop_ioctl;
+            break;
+
         default:
             return -ENOIOCTLCMD;
     }
 
-    if ( copy_from_user(data, (void __user *)arg, _IOC_SIZE(cmd)) )
-        return -EFAULT;
+    // per-cpu records do not fit on the stack
+    if ( _IOC_SIZE(cmd) > sizeof(small) ) {
+        data = kmalloc(_IOC_SIZE(cmd), GFP_KERNEL);
+        if ( !data ) {
+            return -ENOMEM;
+        }
+    }
+
+    if ( copy_from_user(data, (void __user *)arg, _IOC_SIZE(cmd)) ) {
+        ret = -EFAULT;
+        goto out;
+    }
 
     ret = handler(filep, cmd, (unsigned long)((void *)data));
 
     if ( !ret && (cmd & IOC_OUT) ) {
         if ( copy_to_user((void __user *)arg, data, _IOC_SIZE(cmd)) )
-            return -EFAULT;
+            ret = -EFAULT;
     }
 
+out:
+    if ( data != small ) {
+        kfree(data);
+    }
     return ret;
 }
 
@@ -301,6 +634,20 @@ static int module_open(struct inode *inode, struct file *file) {
     }
     INFO("opened!");
 
+    // zeroed, so head / tail / epoch start at 0
+    sampler_ring = vmalloc_user(PAGE_ALIGN(SAMPLER_RING_SIZE));
+    if ( !sampler_ring ) {
+        return -ENOMEM;
+    }
+    sampler_ring->slots       = SAMPLER_SLOTS;
+    sampler_ring->sample_size = sizeof(struct sample_t);
+    sampler_samples           = (struct sample_t *)((uint8_t *)sampler_ring + SAMPLER_HEADER_SIZE);
+
+    // every user uploads its own list
+    msr_list.count  = 0;
+    msr_begin_count = 0;
+    msr_end_count   = 0;
+
     device_open_count++;
     try_module_get(THIS_MODULE);
 
@@ -308,6 +655,11 @@ static int module_open(struct inode *inode, struct file *file) {
 }
 
 static int module_release(struct inode *inode, struct file *file) {
+    // a mapping holds a reference to the file, so nobody can access the ring anymore
+    sampler_stop();
+    vfree(sampler_ring);
+    sampler_ring = NULL;
+
     device_open_count--;
     module_put(THIS_MODULE);
     INFO("released!");
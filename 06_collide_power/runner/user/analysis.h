@@ -0,0 +1,207 @@
+#pragma once
+
+#include "config.h"
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+// streaming analysis of the rows while they are captured, so a capture can stop once the leakage is significant
+// instead of running for NUMBER_SAMPLES batches.
+//
+// generate_state() writes every state twice: row r with guess g and its twin i with the inverted guess ~g (same value
+// v). The difference d = E(r) - E(i) of such a pair cancels everything that drifts slower than two windows
+// (temperature, load, frequency). If the power depends on the Hamming distance between guess and value,
+// d grows linearly with x = HD(g, v) - HD(~g, v), so the analysis fits d = a + b * x online and tests b != 0.
+// Next to the fit it keeps mean and variance of d per (guess, value) nibble class, which shows the recovered value.
+// Besides the raw package and PP0 energy, it analyses the package energy per attacker iteration (from the telemetry of
+// the attackers), which removes the variance of how much work the attackers got done in a window.
+
+// running mean and variance (Welford)
+struct welford_t {
+    uint64_t n    = 0;
+    double   mean = 0;
+    double   m2   = 0;
+
+    void add(double x) {
+        ++n;
+        double delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
+    }
+
+    double variance() const {
+        return n > 1 ? m2 / (n - 1) : 0;
+    }
+};
+
+// online least squares y = a + b * x from running means and co-moments
+struct regression_t {
+    uint64_t n      = 0;
+    double   mean_x = 0;
+    double   mean_y = 0;
+    double   m2_x   = 0;
+    double   m2_y   = 0;
+    double   c_xy   = 0;
+
+    void add(double x, double y) {
+        ++n;
+        double dx = x - mean_x;
+        mean_x += dx / n;
+        double dy = y - mean_y;
+        mean_y += dy / n;
+        m2_x += dx * (x - mean_x);
+        m2_y += dy * (y - mean_y);
+        c_xy += dx * (y - mean_y);
+    }
+
+    double slope() const {
+        return m2_x > 0 ? c_xy / m2_x : 0;
+    }
+
+    // t-statistic of the slope (n - 2 degrees of freedom, normal for the sample sizes here)
+    double t() const {
+        if ( n < 3 || m2_x <= 0 ) {
+            return 0;
+        }
+        double residual = (m2_y - slope() * c_xy) / (n - 2);
+        return residual > 0 ? slope() / std::sqrt(residual / m2_x) : 0;
+    }
+};
+
+// two-sided: |t| above this value rejects b = 0 with the given confidence (bisection on erfc)
+inline double critical_t(double confidence) {
+    double low = 0, high = 40;
+    for ( int i = 0; i < 100; ++i ) {
+        double middle = (low + high) / 2;
+        (std::erfc(middle / std::sqrt(2.0)) > 1 - confidence ? low : high) = middle;
+    }
+    return high;
+}
+
+class online_analysis {
+    struct channel_t {
+        char const  *name;
+        regression_t fit;
+        // [guess nibble][value nibble] of row r
+        std::array<std::array<welford_t, 16>, 16> classes;
+    };
+
+    std::array<channel_t, 3> channels_ = { channel_t { .name = "Energy" }, channel_t { .name = "EnergyPP0" }, channel_t { .name = "EnergyPerIter" } };
+
+    double   critical_;
+    uint64_t skipped_ = 0;
+
+    // NaN if the channel has no value for this row
+    static double energy(row_t const &row, size_t channel) {
+        if ( channel == 0 ) {
+            return row.measurements.energy_pkg;
+        }
+        if ( channel == 1 ) {
+            return row.measurements.energy_pp0;
+        }
+        uint64_t iterations = 0;
+        for ( attacker_telemetry_t const &attacker : row.attackers ) {
+            iterations += attacker.iterations;
+        }
+        // per million iterations, only to keep the printed slope readable
+        return iterations ? row.measurements.energy_pkg * 1e6 / iterations : NAN;
+    }
+
+  public:
+    explicit online_analysis(double confidence) : critical_(confidence > 0 ? critical_t(confidence) : INFINITY) {}
+
+    // rows as filled by generate_state() and measured, pairs at 2 * e and 2 * e + 1
+    void add(row_t const *rows, size_t count) {
+        for ( size_t e = 0; e + 1 < count; e += 2 ) {
+            row_t const &r = rows[e];
+            row_t const &i = rows[e + 1];
+
+            // stream mode leaves a row empty if no sample fell into its window
+            if ( !r.measurements.cycles || !i.measurements.cycles ) {
+                ++skipped_;
+                continue;
+            }
+
+            uint8_t guess = r.guess[0] & 0xF;
+            uint8_t value = r.value[0] & 0xF;
+            double  x     = std::popcount<uint8_t>((guess ^ value) & 0xF) - std::popcount<uint8_t>((~guess ^ value) & 0xF);
+
+            for ( size_t c = 0; c < channels_.size(); ++c ) {
+                double d = energy(r, c) - energy(i, c);
+                if ( std::isnan(d) ) {
+                    continue;
+                }
+                channels_[c].fit.add(x, d);
+                channels_[c].classes[guess][value].add(d);
+            }
+        }
+    }
+
+    uint64_t pairs() const {
+        return channels_[0].fit.n;
+    }
+
+    size_t channels() const {
+        return channels_.size();
+    }
+
+    char const *channel_name(size_t channel) const {
+        return channels_[channel].name;
+    }
+
+    double t(size_t channel) const {
+        return channels_[channel].fit.t();
+    }
+
+    // true once any channel is significant. Checked after every batch, the repeated looks are why the default
+    // confidence is far above the usual 0.95
+    bool significant() const {
+        for ( channel_t const &channel : channels_ ) {
+            if ( std::fabs(channel.fit.t()) >= critical_ ) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // one line for the progress output
+    void print_status(FILE *out) const {
+        fprintf(out, "%10zu pairs", pairs());
+        for ( channel_t const &channel : channels_ ) {
+            fprintf(out, "  %s: b = %9.3f t = %7.2f", channel.name, channel.fit.slope(), channel.fit.t());
+        }
+        fprintf(out, " (stop at |t| >= %.2f) ", critical_);
+    }
+
+    // for every value nibble the guess nibble whose mean difference is most extreme in the direction of the fit
+    // (with a positive slope, the smallest d is at guess == value)
+    void print_report(FILE *out) const {
+        print_status(out);
+        fprintf(out, "\n");
+        if ( skipped_ ) {
+            fprintf(out, "skipped %zu pairs without measurement\n", skipped_);
+        }
+        for ( channel_t const &channel : channels_ ) {
+            double sign = channel.fit.slope() >= 0 ? 1 : -1;
+            fprintf(out, "%s guess per value:", channel.name);
+            for ( size_t value = 0; value < 16; ++value ) {
+                int best = -1;
+                for ( int guess = 0; guess < 16; ++guess ) {
+                    welford_t const &cls = channel.classes[guess][value];
+                    if ( cls.n && (best < 0 || sign * cls.mean < sign * channel.classes[best][value].mean) ) {
+                        best = guess;
+                    }
+                }
+                if ( best < 0 ) {
+                    fprintf(out, " %zx:-", value);
+                } else {
+                    fprintf(out, " %zx:%x", value, best);
+                }
+            }
+            fprintf(out, "\n");
+        }
+    }
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "control.h"
+#include "interface.h"
+#include "msr_list.h"
+
+#include <bit>
+#include <random>
+
+// deterministic stand-in for the hardware: synthesizes every measurement from a leakage model instead of measuring,
+// so the runner, the npy output and the online analysis run on any machine, without root, module or attackers.
+//
+//   energy = base * us / 10000 + leak * HD(guess, value) + N(0, noise)    (package, PP0 with half the base)
+//
+// HD is the Hamming distance of the full payloads of the state. Configuration via environment variables:
+//   SL_MOCK_BASE=<units>   energy of a 10 ms window without leakage (default 3000)
+//   SL_MOCK_LEAK=<units>   energy per differing bit (default 0.05)
+//   SL_MOCK_NOISE=<units>  standard deviation of the noise (default 20)
+//   SL_MOCK_SEED=<n>       seed of the noise (default 0), the same seed gives the same measurements
+// The window is not waited for, a mock capture runs as fast as the runner can generate and write rows.
+class mock_backend : public backend_t {
+    double base_;
+    double leak_;
+
+    std::mt19937_64                  random_;
+    std::normal_distribution<double> noise_;
+
+    uint64_t distance_ = 0;
+
+    msr_list_t msrs_ = {};
+
+    static double config(char const *name, double fallback) {
+        char const *value = getenv(name);
+        return value ? strtod(value, nullptr) : fallback;
+    }
+
+    uint32_t energy(double base) {
+        double value = base + leak_ * distance_ + noise_(random_);
+        return value > 0 ? (uint32_t)std::llround(value) : 0;
+    }
+
+  public:
+    mock_backend()
+        : base_(config("SL_MOCK_BASE", 3000)), leak_(config("SL_MOCK_LEAK", 0.05)),
+          random_((uint64_t)config("SL_MOCK_SEED", 0)), noise_(0, config("SL_MOCK_NOISE", 20)) {}
+
+    char const *name() const override {
+        return "mock";
+    }
+
+    void state(uint8_t const *guess, uint8_t const *value) override {
+        distance_ = 0;
+        for ( size_t i = 0; i < CONTROL_PAYLOAD_SIZE; ++i ) {
+            distance_ += std::popcount<uint8_t>(guess[i] ^ value[i]);
+        }
+    }
+
+    // no registers to read, descriptors of the tsc get the window in cycles, all others 0
+    bool set_msrs(msr_list_t const &list) override {
+        msrs_ = list;
+        return true;
+    }
+
+    bool attackers() const override {
+        return false;
+    }
+
+    void measure(measurement_cpus_t &data, uint64_t cpu_mask, uint32_t us) override {
+        // 3 GHz, always at nominal frequency
+        uint64_t cycles = 3000ull * us;
+        double   base   = base_ * us / 10000;
+
+        data.package             = {};
+        data.package.energy_pkg  = energy(base);
+        data.package.energy_pp0  = energy(base / 2);
+        data.package.cycles      = cycles;
+        data.package.aperf       = cycles;
+        data.package.mperf       = cycles;
+        data.package.temperature = 50;
+
+        memset(data.cores, 0, sizeof(data.cores));
+        size_t count = 0;
+        for ( uint32_t cpu = 0; cpu < 64 && count < MEASURE_MAX_CPUS; ++cpu ) {
+            if ( cpu_mask & (1ull << cpu) ) {
+                core_measurement_t &core = data.cores[count++];
+                core.cycles              = cycles;
+                core.aperf               = cycles;
+                core.mperf               = cycles;
+                core.temperature         = 50;
+                core.cpu                 = cpu;
+                core.valid               = 1;
+            }
+        }
+
+        memset(data.msrs, 0, sizeof(data.msrs));
+        for ( uint32_t i = 0; i < msrs_.count; ++i ) {
+            if ( msrs_.desc[i].msr == MSR_DESC_TSC ) {
+                data.msrs[i] = msr_descriptors::value(msrs_.desc[i], 0, cycles);
+            }
+        }
+    }
+};
@@ -0,0 +1,276 @@
+#pragma once
+
+#include "interface.h"
+#include "msr_list.h"
+
+#include <cmath>
+#include <ctime>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <x86intrin.h>
+
+// measures without the kernel module: energy from the perf power PMU (power/energy-pkg, energy-cores, energy-ram),
+// APERF / MPERF from the perf msr PMU or /dev/cpu/N/msr, perf status and temperature from /dev/cpu/N/msr. Everything
+// except the energy is optional, missing counters stay 0. Needs perf_event_paranoid <= 0 (or CAP_PERFMON) for the
+// PMUs and root plus the msr driver for /dev/cpu/N/msr.
+//
+// Energy is converted to the unit of the RAPL status registers (as the module reports it), the energy status unit is
+// read from MSR_RAPL_POWER_UNIT if possible. Package counters are read on the controller core, per-core counters with
+// one read per core right before and after the window, which is not as simultaneous as the IPIs of the module. The MSR
+// descriptor list is read on the controller core through /dev/cpu/N/msr, one pread per register.
+class perf_backend : public backend_t {
+    static constexpr uint32_t MSR_RAPL_POWER_UNIT         = 0x606;
+    static constexpr uint32_t MSR_IA32_MPERF              = 0xE7;
+    static constexpr uint32_t MSR_IA32_APERF              = 0xE8;
+    static constexpr uint32_t MSR_IA32_PERF_STATUS        = 0x198;
+    static constexpr uint32_t MSR_IA32_THERM_STATUS       = 0x19C;
+    static constexpr uint32_t MSR_IA32_TEMPERATURE_TARGET = 0x1A2;
+
+    struct event_t {
+        int    fd    = -1;
+        double scale = 1;
+    };
+
+    struct core_t {
+        bool    opened = false;
+        int     msr    = -1;
+        event_t aperf;
+        event_t mperf;
+    };
+
+    uint32_t controller_;
+    double   energy_unit_ = 1.0 / (1 << 14);
+
+    event_t pkg_;
+    event_t pp0_;
+    event_t dram_;
+    core_t  package_;
+    core_t  cores_[64];
+
+    msr_list_t msrs_ = {};
+
+    static bool read_sysfs(std::string const &path, std::string &value) {
+        FILE *file = fopen(path.c_str(), "r");
+        if ( !file ) {
+            return false;
+        }
+        char buffer[128] = {};
+        bool ok          = fgets(buffer, sizeof(buffer), file) != nullptr;
+        fclose(file);
+        value = buffer;
+        return ok;
+    }
+
+    // opens pmu/name (system wide on cpu), only "event=0x.." configurations are supported
+    static event_t open_event(char const *pmu, char const *name, uint32_t cpu) {
+        std::string base = std::string("/sys/bus/event_source/devices/") + pmu;
+        std::string type, config, scale;
+        event_t     event;
+        if ( !read_sysfs(base + "/type", type) || !read_sysfs(base + "/events/" + name, config) || config.rfind("event=", 0) ) {
+            return event;
+        }
+        if ( read_sysfs(base + "/events/" + name + ".scale", scale) ) {
+            event.scale = strtod(scale.c_str(), nullptr);
+        }
+
+        perf_event_attr attr = {};
+        attr.type            = strtoul(type.c_str(), nullptr, 0);
+        attr.size            = sizeof(attr);
+        attr.config          = strtoull(config.c_str() + strlen("event="), nullptr, 0);
+        event.fd             = syscall(SYS_perf_event_open, &attr, -1, cpu, -1, 0);
+        return event;
+    }
+
+    static double read_event(event_t const &event) {
+        uint64_t value = 0;
+        if ( event.fd < 0 || read(event.fd, &value, sizeof(value)) != sizeof(value) ) {
+            return 0;
+        }
+        return value * event.scale;
+    }
+
+    static uint64_t read_msr(int msr, uint32_t index) {
+        uint64_t value = 0;
+        if ( msr < 0 || pread(msr, &value, sizeof(value), index) != sizeof(value) ) {
+            return 0;
+        }
+        return value;
+    }
+
+    static core_t open_core(uint32_t cpu) {
+        char path[64];
+        snprintf(path, sizeof(path), "/dev/cpu/%u/msr", cpu);
+        core_t core;
+        core.opened = true;
+        core.msr    = ::open(path, O_RDONLY);
+        core.aperf  = open_event("msr", "aperf", cpu);
+        core.mperf  = open_event("msr", "mperf", cpu);
+        return core;
+    }
+
+    static void close_core(core_t &core) {
+        for ( int fd : { core.msr, core.aperf.fd, core.mperf.fd } ) {
+            if ( fd >= 0 ) {
+                close(fd);
+            }
+        }
+        core = {};
+    }
+
+    struct counters_t {
+        uint64_t tsc;
+        uint64_t aperf;
+        uint64_t mperf;
+    };
+
+    static counters_t read_core(core_t const &core) {
+        counters_t counters = { .tsc = __rdtsc() };
+        counters.aperf      = core.aperf.fd >= 0 ? read_event(core.aperf) : read_msr(core.msr, MSR_IA32_APERF);
+        counters.mperf      = core.mperf.fd >= 0 ? read_event(core.mperf) : read_msr(core.msr, MSR_IA32_MPERF);
+        return counters;
+    }
+
+    // same decoding as measure_end in the module
+    template<typename T>
+    static void read_status(core_t const &core, T &out) {
+        uint64_t perf_status  = read_msr(core.msr, MSR_IA32_PERF_STATUS);
+        uint64_t therm_status = read_msr(core.msr, MSR_IA32_THERM_STATUS);
+        uint64_t therm_target = read_msr(core.msr, MSR_IA32_TEMPERATURE_TARGET);
+
+        out.voltage = (perf_status & 0xFFFF00000000llu) >> 32;
+        out.pstate  = (perf_status & 0xFFFFllu) >> 8;
+        if ( therm_target ) {
+            out.temperature = ((therm_target >> 16) & 0xFF) - ((therm_status >> 16) & 0x7F);
+        }
+    }
+
+    uint64_t read_descriptor(msr_desc_t const &desc) const {
+        return desc.msr == MSR_DESC_TSC ? __rdtsc() : read_msr(package_.msr, desc.msr);
+    }
+
+    uint32_t energy(double joules) const {
+        return (uint32_t)std::llround(joules / energy_unit_);
+    }
+
+  public:
+    explicit perf_backend(uint32_t controller) : controller_(controller) {}
+
+    ~perf_backend() override {
+        for ( event_t const &event : { pkg_, pp0_, dram_ } ) {
+            if ( event.fd >= 0 ) {
+                close(event.fd);
+            }
+        }
+        close_core(package_);
+        for ( core_t &core : cores_ ) {
+            close_core(core);
+        }
+    }
+
+    bool open() {
+        pkg_ = open_event("power", "energy-pkg", controller_);
+        if ( pkg_.fd < 0 ) {
+            // virtual machines often only expose the platform domain
+            pkg_ = open_event("power", "energy-psys", controller_);
+            if ( pkg_.fd < 0 ) {
+                perror("perf_event_open power/energy-pkg");
+                return false;
+            }
+            printf("perf backend: no power/energy-pkg, using power/energy-psys\n");
+        }
+        pp0_     = open_event("power", "energy-cores", controller_);
+        dram_    = open_event("power", "energy-ram", controller_);
+        package_ = open_core(controller_);
+
+        uint64_t unit = read_msr(package_.msr, MSR_RAPL_POWER_UNIT);
+        if ( unit ) {
+            energy_unit_ = 1.0 / (1ull << ((unit >> 8) & 0x1F));
+        }
+        return true;
+    }
+
+    char const *name() const override {
+        return "perf";
+    }
+
+    bool set_msrs(msr_list_t const &list) override {
+        for ( uint32_t i = 0; i < list.count; ++i ) {
+            uint64_t value;
+            if ( list.desc[i].msr != MSR_DESC_TSC && pread(package_.msr, &value, sizeof(value), list.desc[i].msr) != sizeof(value) ) {
+                printf("perf backend: cannot read msr %#x of %s\n", list.desc[i].msr, list.desc[i].name);
+                return false;
+            }
+        }
+        msrs_ = list;
+        return true;
+    }
+
+    void measure(measurement_cpus_t &data, uint64_t cpu_mask, uint32_t us) override {
+        for ( uint32_t cpu = 0; cpu < 64; ++cpu ) {
+            if ( (cpu_mask & (1ull << cpu)) && !cores_[cpu].opened ) {
+                cores_[cpu] = open_core(cpu);
+            }
+        }
+
+        size_t     count = 0;
+        counters_t begin[MEASURE_MAX_CPUS];
+        memset(data.cores, 0, sizeof(data.cores));
+        for ( uint32_t cpu = 0; cpu < 64 && count < MEASURE_MAX_CPUS; ++cpu ) {
+            if ( cpu_mask & (1ull << cpu) ) {
+                begin[count++] = read_core(cores_[cpu]);
+            }
+        }
+
+        // same order as the module: begin reads in reverse list order, end reads in list order
+        uint64_t begin_msrs[MEASURE_MAX_MSRS] = {};
+        for ( uint32_t i = msrs_.count; i-- > 0; ) {
+            if ( msrs_.desc[i].kind != MSR_KIND_END ) {
+                begin_msrs[i] = read_descriptor(msrs_.desc[i]);
+            }
+        }
+
+        counters_t package = read_core(package_);
+        double     pkg     = read_event(pkg_);
+        double     pp0     = read_event(pp0_);
+        double     dram    = read_event(dram_);
+
+        // busy wait like the udelay of the module, the controller core stays busy during the window
+        timespec start, now;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        } while ( (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000 < us );
+
+        data.package             = {};
+        data.package.energy_pp0  = energy(read_event(pp0_) - pp0);
+        data.package.energy_pkg  = energy(read_event(pkg_) - pkg);
+        data.package.energy_dram = energy(read_event(dram_) - dram);
+
+        memset(data.msrs, 0, sizeof(data.msrs));
+        for ( uint32_t i = 0; i < msrs_.count; ++i ) {
+            uint64_t end = msrs_.desc[i].kind != MSR_KIND_BEGIN ? read_descriptor(msrs_.desc[i]) : 0;
+            data.msrs[i] = msr_descriptors::value(msrs_.desc[i], begin_msrs[i], end);
+        }
+        counters_t end           = read_core(package_);
+        data.package.cycles      = end.tsc - package.tsc;
+        data.package.aperf       = end.aperf - package.aperf;
+        data.package.mperf       = end.mperf - package.mperf;
+        read_status(package_, data.package);
+
+        count = 0;
+        for ( uint32_t cpu = 0; cpu < 64 && count < MEASURE_MAX_CPUS; ++cpu ) {
+            if ( !(cpu_mask & (1ull << cpu)) ) {
+                continue;
+            }
+            core_measurement_t &core     = data.cores[count];
+            counters_t          counters = read_core(cores_[cpu]);
+            core.cycles                  = counters.tsc - begin[count].tsc;
+            core.aperf                   = counters.aperf - begin[count].aperf;
+            core.mperf                   = counters.mperf - begin[count].mperf;
+            core.cpu                     = cpu;
+            core.valid                   = cores_[cpu].msr >= 0 || cores_[cpu].aperf.fd >= 0;
+            read_status(cores_[cpu], core);
+            ++count;
+        }
+    }
+};
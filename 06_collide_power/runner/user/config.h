@@ -2,7 +2,9 @@
 
 #include "../module/interface.h"
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cassert>
 #include <cstdint>
 #include <cstdio>
@@ -18,6 +20,41 @@ constexpr size_t NUMBER_SAMPLES = 300000;
 // repeat per randomly choosen parameter, counteract dynamic states
 constexpr size_t EXPERIMENT_REPEAT = 1000;
 
+// how often the npy writer syncs the output and updates its shape, a reader sees rows at most this late
+constexpr std::chrono::milliseconds WRITE_CADENCE { 1000 };
+
+// online analysis (analysis.h): stop the capture once the energy difference of the paired rows depends on the Hamming
+// distance of guess and value with this two-sided confidence, 0 captures all NUMBER_SAMPLES batches
+constexpr double STOP_CONFIDENCE = 0.999999;
+// pairs before the early stop is considered, the first batches are too noisy to trust a single significant look
+constexpr size_t STOP_MIN_PAIRS = 50 * EXPERIMENT_REPEAT / 2;
+
+// attacker instances started by the runner. Every instance runs the same state, more instances give a larger power
+// delta per sample
+constexpr size_t NUMBER_ATTACKERS = 1;
+
+// PHYSICAL: one instance per physical core, SMT: all hyperthreads of a core before the next core
+enum class placement_t { PHYSICAL, SMT };
+constexpr placement_t ATTACKER_PLACEMENT = placement_t::PHYSICAL;
+
+// attacker cores measured per row (APERF / MPERF, voltage and temperature are per core)
+constexpr size_t MEASURED_CORES = NUMBER_ATTACKERS;
+static_assert(MEASURED_CORES <= MEASURE_MAX_CPUS);
+
+// columns for the values of the MSR descriptor list (SL_MSRS, msr_list.h), unused columns stay 0
+constexpr size_t MSR_COLUMNS = 8;
+static_assert(MSR_COLUMNS <= MEASURE_MAX_MSRS);
+
+// telemetry of one attacker instance during the window of a row (control_report in the attacker)
+struct [[gnu::packed]] attacker_telemetry_t {
+    uint64_t iterations;
+    // hits of the in-asm probe, 0 without COUNT_HITS_IN_ASM
+    uint64_t hits;
+    // sequence of the state the attacker ran at the end of the window
+    uint32_t sequence;
+    uint32_t variant;
+};
+
 struct [[gnu::packed]] row_t {
     time_t        time;
     char          exp[20];
@@ -27,33 +64,94 @@ struct [[gnu::packed]] row_t {
     uint8_t       value[16 * 12];
     uint8_t       guess[16 * 12];
     measurement_t measurements;
+
+    core_measurement_t cores[MEASURED_CORES];
+
+    attacker_telemetry_t attackers[NUMBER_ATTACKERS];
+
+    uint64_t msrs[MSR_COLUMNS];
 };
 static_assert(sizeof(time_t) == 8);
 static_assert(sizeof(row_t {}.guess) == 192);
 static_assert(sizeof(row_t {}.value) == 192);
 
-std::vector<std::string> row_t_fields {
-    "('time', 'u8')", //
-    "('Exp', 'S20')", //
-    "('ERep', 'u2')", //
-    "('Dur', 'u2')",  //
-    "('la', 'f4')",   //
-
-    "('Value', 'S192')", //
-    "('Guess', 'S192')", //
-
-    "('Energy', 'u4')",     //
-    "('EnergyPP0', 'u4')",  //
-    "('EnergyDRAM', 'u4')", //
-    "('Ticks', 'u8')",      //
-    "('Volt', 'u8')",       //
-    "('PState', 'u8')",     //
-    "('Temp', 'u8')",       //
-    "('APerf', 'u8')",      //
-    "('Mperf', 'u8')",      //
-    "('dreg', 'i8')",       //
-    "('inst_a', 'u8')",     //
-    "('inst_b', 'u8')",     //
-    "('temp_a', 'u8')",     //
-    "('temp_b', 'u8')",     //
+// Core<n>*: per-core record of the attacker cores in ascending cpu order, Valid is 0 in stream mode
+// A<n>*: telemetry of attacker instance n, iterations and hits during the window
+// then one column per descriptor of the MSR list, named by the descriptor (Msr<n> if unused)
+std::vector<std::string> row_t_fields(msr_list_t const &msrs) {
+    std::vector<std::string> fields {
+        "('time', 'u8')", //
+        "('Exp', 'S20')", //
+        "('ERep', 'u2')", //
+        "('Dur', 'u2')",  //
+        "('la', 'f4')",   //
+
+        "('Value', 'S192')", //
+        "('Guess', 'S192')", //
+
+        "('Energy', 'u4')",     //
+        "('EnergyPP0', 'u4')",  //
+        "('EnergyDRAM', 'u4')", //
+        "('Ticks', 'u8')",      //
+        "('Volt', 'u8')",       //
+        "('PState', 'u8')",     //
+        "('Temp', 'u8')",       //
+        "('APerf', 'u8')",      //
+        "('Mperf', 'u8')",      //
+        "('dreg', 'i8')",       //
+        "('inst_a', 'u8')",     //
+        "('inst_b', 'u8')",     //
+        "('temp_a', 'u8')",     //
+        "('temp_b', 'u8')",     //
+    };
+    for ( size_t n = 0; n < MEASURED_CORES; ++n ) {
+        std::string core = "Core" + std::to_string(n);
+        for ( char const *field : { "Ticks", "APerf", "Mperf", "Volt", "PState", "Temp" } ) {
+            fields.push_back("('" + core + field + "', 'u8')");
+        }
+        fields.push_back("('" + core + "Cpu', 'u4')");
+        fields.push_back("('" + core + "Valid', 'u4')");
+    }
+    for ( size_t n = 0; n < NUMBER_ATTACKERS; ++n ) {
+        std::string attacker = "A" + std::to_string(n);
+        fields.push_back("('" + attacker + "Iter', 'u8')");
+        fields.push_back("('" + attacker + "Hits', 'u8')");
+        fields.push_back("('" + attacker + "Seq', 'u4')");
+        fields.push_back("('" + attacker + "Variant', 'u4')");
+    }
+    for ( size_t n = 0; n < MSR_COLUMNS; ++n ) {
+        std::string name = n < msrs.count ? msrs.desc[n].name : "Msr" + std::to_string(n);
+        fields.push_back("('" + name + "', 'u8')");
+    }
+    return fields;
+}
+
+// numpy rejects a dtype with a name twice (an MSR descriptor named like a fixed column)
+bool unique_fields(std::vector<std::string> const &fields) {
+    std::vector<std::string> names;
+    for ( std::string const &field : fields ) {
+        std::string name = field.substr(2, field.find('\'', 2) - 2);
+        if ( std::find(names.begin(), names.end(), name) != names.end() ) {
+            printf("column %s twice\n", name.c_str());
+            return false;
+        }
+        names.push_back(name);
+    }
+    return true;
+}
+
+// stream mode: raw samples of the module's sampler, see sample_t
+std::vector<std::string> sample_t_fields {
+    "('Ticks', 'u8')",       //
+    "('APerf', 'u8')",       //
+    "('Mperf', 'u8')",       //
+    "('PerfStatus', 'u8')",  //
+    "('Energy', 'u4')",      //
+    "('EnergyPP0', 'u4')",   //
+    "('EnergyDRAM', 'u4')",  //
+    "('ThermStatus', 'u4')", //
+    "('Epoch', 'u4')",       //
+    "('Cpu', 'u4')",         //
+    "('reserved', 'u8')",    //
 };
+static_assert(sizeof(sample_t) == 64);
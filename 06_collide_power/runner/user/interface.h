@@ -23,6 +23,35 @@
 
 extern int fd;
 
+// measurement backend of the runner (SL_BACKEND): the kernel module (default), the perf PMUs plus /dev/cpu/N/msr
+// (backend_perf.h) or a leakage model (backend_mock.h)
+class backend_t {
+  public:
+    virtual ~backend_t() = default;
+
+    virtual char const *name() const = 0;
+
+    // measures a window of us microseconds like MEASURE_US_CPUS: package counters into data.package, per-core
+    // counters of the cpus in cpu_mask into data.cores
+    virtual void measure(measurement_cpus_t &data, uint64_t cpu_mask, uint32_t us) = 0;
+
+    // registers of the MSR descriptor list, measure fills data.msrs with one value per descriptor
+    virtual bool set_msrs(msr_list_t const &list) = 0;
+
+    // the state the attackers run during the next measure (only a model can make use of it)
+    virtual void state(uint8_t const *guess, uint8_t const *value) {}
+
+    // whether the runner has to start attackers, a model does not need any
+    virtual bool attackers() const {
+        return true;
+    }
+
+    // stream mode maps the sampler ring of the module
+    virtual bool streams() const {
+        return false;
+    }
+};
+
 inline void measure_us(measurement_t &data, uint32_t us) {
     data.cycles = us;
     if ( ioctl(fd, MEASURE_US, &data) < 0 ) {
@@ -30,3 +59,47 @@ inline void measure_us(measurement_t &data, uint32_t us) {
         exit(-1);
     }
 }
+
+// MEASURE_US plus the per-core counters of the cpus in cpu_mask, read on these cpus at the same time
+inline void measure_us_cpus(measurement_cpus_t &data, uint64_t cpu_mask, uint32_t us) {
+    data.cpu_mask       = cpu_mask;
+    data.package.cycles = us;
+    if ( ioctl(fd, MEASURE_US_CPUS, &data) < 0 ) {
+        perror("ioctl error\n");
+        exit(-1);
+    }
+}
+
+class module_backend : public backend_t {
+  public:
+    // we open exactly our kernel module which is named after the parent's parent folder
+    bool open(char const *path) {
+        fd = ::open(path, O_RDWR);
+        if ( fd < 0 ) {
+            printf("cannot open kernel module is it loaded? forgot sudo? %s\n", path);
+            return false;
+        }
+        return true;
+    }
+
+    char const *name() const override {
+        return "module";
+    }
+
+    void measure(measurement_cpus_t &data, uint64_t cpu_mask, uint32_t us) override {
+        measure_us_cpus(data, cpu_mask, us);
+    }
+
+    // the module rejects registers the cpu does not have (see dmesg)
+    bool set_msrs(msr_list_t const &list) override {
+        if ( ioctl(fd, MSR_LIST_SET, &list) < 0 ) {
+            perror("MSR_LIST_SET");
+            return false;
+        }
+        return true;
+    }
+
+    bool streams() const override {
+        return true;
+    }
+};
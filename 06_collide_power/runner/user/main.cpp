@@ -1,70 +1,139 @@
 
 #include "config.h"
+#include "analysis.h"
+#include "env.h"
+#include "control.h"
+#include "trace.h"
 #include "interface.h"
+#include "backend_mock.h"
+#include "backend_perf.h"
 #include "npy_file.h"
+#include "msr_list.h"
+#include "npy_writer.h"
+#include "plan.h"
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <fcntl.h>
+#include <memory>
+#include <poll.h>
 #include <random>
 #include <signal.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/sysinfo.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <vector>
 
 // string utils
 #define XSTR(s) STR(s)
 #define STR(s)  #s
 
-constexpr char const *SHM_ATTACKER = "/shm_attacker";
-constexpr char const *SHM_VICTIM   = "/shm_victim";
+constexpr char const *SHM_CONTROL = "/shm_control";
 
-// amplification factor
-// 8 for experimenet 64 for amplification
-constexpr uint8_t NUMBER_BYTES = 64;
+// how long the runner waits for the attackers to finish their setup / to apply a new state
+constexpr uint64_t READY_TIMEOUT_MS = 10'000;
+constexpr uint64_t ACK_TIMEOUT_MS   = 1'000;
 
 int fd;
 
-static uint8_t core_controller = 5;
+// SL_BACKEND=module|perf|mock, see make_backend
+static std::unique_ptr<backend_t> backend;
+
+// SL_PLAN=<file>, see plan.h. Without a plan file it holds the single cell of the defaults
+static experiment_plan plan;
+
+static uint8_t core_controller = DEFAULT_CONTROLLER;
 
 struct thread_id {
     uint8_t  core_id;
     uint64_t pid;
+    // readable once the process exited, unlike the pid it cannot refer to a recycled process
+    int pidfd = -1;
 };
 
-// core configuration
-static std::array id_attacker = { thread_id { .core_id = 0 } };
+// core configuration, see place_attackers
+static std::array<thread_id, NUMBER_ATTACKERS> id_attacker;
 
 static_assert(EXPERIMENT_REPEAT % 2 == 0);
+static_assert(NUMBER_ATTACKERS <= CONTROL_MAX_ATTACKERS);
+static_assert(id_attacker.size() == MEASURED_CORES);
+
+// rows of the current batch, a block of the npy writer
+static row_t *rows;
+
+struct cpu_topology {
+    uint32_t cpu;
+    uint32_t package;
+    uint32_t core;
+};
 
-static row_t rows[EXPERIMENT_REPEAT] = {};
+bool read_topology(uint32_t cpu, char const *name, uint32_t &value) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/%s", cpu, name);
+    FILE *file = fopen(path, "r");
+    if ( !file ) {
+        return false;
+    }
+    bool ok = fscanf(file, "%u", &value) == 1;
+    fclose(file);
+    return ok;
+}
 
-// get the shared memory for the keys
-uint8_t *create_shm_keys(char const *shm_name) {
-    int fd = shm_open(shm_name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-    if ( fd < 0 ) {
-        perror("shm_open");
-        return nullptr;
+// picks the attacker cores on the package of the controller (the package energy is read there), in cpu order and
+// without the physical core of the controller, so the measuring core never shares a core with an attacker
+bool place_attackers() {
+    std::vector<cpu_topology> cpus;
+    // the cpu mask of MEASURE_US_CPUS covers the first 64 cpus
+    for ( uint32_t cpu = 0; cpu < 64; ++cpu ) {
+        cpu_topology topology = { .cpu = cpu };
+        if ( read_topology(cpu, "physical_package_id", topology.package) && read_topology(cpu, "core_id", topology.core) ) {
+            cpus.push_back(topology);
+        }
     }
 
-    if ( ftruncate(fd, 0x1000) ) {
-        perror("ftruncate");
-        return nullptr;
+    auto controller = std::find_if(cpus.begin(), cpus.end(), [](cpu_topology const &x) { return x.cpu == core_controller; });
+    if ( controller == cpus.end() ) {
+        printf("controller core %d is offline!\n", core_controller);
+        return false;
     }
 
-    void *addr = mmap(NULL, 0x1000, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
-    if ( addr == MAP_FAILED ) {
-        perror("mmap");
-        return nullptr;
+    std::vector<uint32_t> cores;
+    for ( cpu_topology const &x : cpus ) {
+        if ( x.package == controller->package && x.core != controller->core && std::find(cores.begin(), cores.end(), x.core) == cores.end() ) {
+            cores.push_back(x.core);
+        }
     }
 
-    return (uint8_t *)addr;
+    size_t placed = 0;
+    for ( uint32_t core : cores ) {
+        for ( cpu_topology const &x : cpus ) {
+            if ( placed == NUMBER_ATTACKERS ) {
+                return true;
+            }
+            if ( x.package == controller->package && x.core == core ) {
+                id_attacker[placed++].core_id = x.cpu;
+                if ( ATTACKER_PLACEMENT == placement_t::PHYSICAL ) {
+                    break;
+                }
+            }
+        }
+    }
+    if ( placed < NUMBER_ATTACKERS ) {
+        printf("only %zu of %zu attacker cores available!\n", placed, NUMBER_ATTACKERS);
+        return false;
+    }
+    return true;
 }
 
 // invoke the aes victim or attacker
@@ -84,14 +153,82 @@ void fork_exec(thread_id &id, const char *exec, Ts... xs) {
         _exit(0);
     }
 
-    id.pid = pid;
+    id.pid   = pid;
+    id.pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if ( id.pidfd < 0 ) {
+        perror("pidfd_open");
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        exit(-1);
+    }
+}
+
+// the package counters are read on the controller core, the per-core counters on the attacker cores themselves
+[[gnu::noinline]] void record_one_sample(row_t &row) {
+    static measurement_cpus_t data;
+
+    uint64_t cpu_mask = 0;
+    for ( thread_id const &tid : id_attacker ) {
+        cpu_mask |= 1ull << tid.core_id;
+    }
+    backend->measure(data, cpu_mask, row.dur);
+
+    row.measurements = data.package;
+    std::memcpy(row.cores, data.cores, sizeof(row.cores));
+    std::memcpy(row.msrs, data.msrs, sizeof(row.msrs));
+}
+
+// stream mode: instead of one MEASURE_US ioctl per sample, the module samples the attacker core on an hrtimer into a
+// ring that we map. Every state gets an epoch that the module copies into its samples, the measurement of a row is
+// derived from the first and last sample of its epoch and all samples go to <output>.samples.npy
+static sampler_header      *ring = nullptr;
+static sample_t            *ring_samples;
+static std::vector<sample_t> samples;
+
+void drain_samples() {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    for ( ; tail != head; ++tail ) {
+        samples.push_back(ring_samples[tail % SAMPLER_SLOTS]);
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
 }
 
-[[gnu::noinline]] void record_one_sample(measurement_t &result) {
-    measure_us(result, 10000);
+[[gnu::noinline]] void stream_one_sample(measurement_t &result, uint32_t epoch, uint32_t us) {
+    __atomic_store_n(&ring->epoch, epoch, __ATOMIC_RELEASE);
+    size_t begin = samples.size();
+
+    // sleep through the window, the hrtimer does the sampling
+    usleep(us);
+    drain_samples();
+
+    sample_t const *first = nullptr, *last = nullptr;
+    for ( size_t i = begin; i < samples.size(); ++i ) {
+        if ( samples[i].epoch == epoch ) {
+            first = first ? first : &samples[i];
+            last  = &samples[i];
+        }
+    }
+
+    result = {};
+    if ( !first || first == last ) {
+        return;
+    }
+    // same fields as measure_end in the module, temperature needs the temperature target (ThermStatus is in the samples)
+    result.energy_pkg  = last->energy_pkg - first->energy_pkg;
+    result.energy_pp0  = last->energy_pp0 - first->energy_pp0;
+    result.energy_dram = last->energy_dram - first->energy_dram;
+    result.cycles      = last->tsc - first->tsc;
+    result.aperf       = last->aperf - first->aperf;
+    result.mperf       = last->mperf - first->mperf;
+    result.voltage     = (last->perf_status & 0xFFFF00000000llu) >> 32;
+    result.pstate      = (last->perf_status & 0xFFFFllu) >> 8;
 }
 
-[[gnu::noinline]] void generate_state() {
+// fills a batch for one cell of the plan
+// the draws of a batch only depend on the seed of the plan and the batch index, so a capture (and a resumed one)
+// measures the same guesses / values
+[[gnu::noinline]] void generate_state(plan_cell_t const &cell, uint64_t batch) {
 
     struct sysinfo info;
 
@@ -99,7 +236,12 @@ void fork_exec(thread_id &id, const char *exec, Ts... xs) {
 
     float la = info.loads[0];
 
-    for ( size_t e = 0; e < EXPERIMENT_REPEAT / 2; ++e ) {
+    std::string exp = experiment_plan::name(cell);
+
+    std::seed_seq   sequence { (uint32_t)plan.seed, (uint32_t)(plan.seed >> 32), (uint32_t)batch, (uint32_t)(batch >> 32) };
+    std::mt19937_64 random(sequence);
+
+    for ( size_t e = 0; e < plan.rows / 2; ++e ) {
 
         row_t &r = rows[2 * e + 0];
         row_t &i = rows[2 * e + 1];
@@ -110,58 +252,185 @@ void fork_exec(thread_id &id, const char *exec, Ts... xs) {
         r.la = la;
         i.la = la;
 
-        strncpy(r.exp, "pf", sizeof(r.exp));
-        strncpy(i.exp, "pf", sizeof(i.exp));
+        // S20 needs no terminator, the rest of the (zeroed) field stays 0
+        exp.copy(r.exp, sizeof(r.exp));
+        exp.copy(i.exp, sizeof(i.exp));
 
-        r.dur = 10000;
-        i.dur = 10000;
+        r.dur = cell.duration_us;
+        i.dur = cell.duration_us;
 
         // draw nibble
-        uint8_t v = rand() & 0xF;
-        uint8_t g = rand() & 0xF;
+        uint8_t v = random() & 0xF;
+        uint8_t g = random() & 0xF;
 
         v |= (v << 4);
         g |= (g << 4);
 
         // fill the guess and value
-        memset(r.value, v, NUMBER_BYTES);
-        memset(r.guess, g, NUMBER_BYTES);
+        memset(r.value, v, cell.bytes);
+        memset(r.guess, g, cell.bytes);
 
         // invert
         g = ~g;
 
         // copy to inverse sample
-        memset(i.value, v, NUMBER_BYTES);
-        memset(i.guess, g, NUMBER_BYTES);
+        memset(i.value, v, cell.bytes);
+        memset(i.guess, g, cell.bytes);
     }
 }
 
-void print_iteration(uint64_t index) {
-    fprintf(stdout, "\r%10zu/%10zu ", index * EXPERIMENT_REPEAT, NUMBER_SAMPLES * EXPERIMENT_REPEAT);
+void print_iteration(uint64_t index, online_analysis const &analysis) {
+    fprintf(stdout, "\r%10zu/%10zu ", index * plan.rows, plan.batches * plan.rows);
+    analysis.print_status(stdout);
     fflush(stdout);
 }
 
+// analysis of one cell of the plan, the efficiency of a cell is |t| / sqrt(seconds): with the same leakage, |t| grows
+// with the square root of the pairs, so the cell with the highest value needs the least capture time for a given |t|
+struct cell_result_t {
+    online_analysis analysis { STOP_CONFIDENCE };
+    // wall clock of the batches of this run (at least their window time, the mock backend does not wait), window
+    // time (Dur) of resumed batches
+    double seconds = 0;
+};
+
+static std::vector<cell_result_t> cell_results;
+
+// every cell significant (with enough pairs), for a single cell the same as the overall analysis
+bool cells_significant() {
+    for ( cell_result_t const &result : cell_results ) {
+        if ( result.analysis.pairs() < STOP_MIN_PAIRS || !result.analysis.significant() ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void print_cells(FILE *out) {
+    if ( cell_results.size() < 2 ) {
+        return;
+    }
+    online_analysis const &first = cell_results[0].analysis;
+    fprintf(out, "%-20s %8s %10s %10s", "cell", "dur/us", "pairs", "seconds");
+    for ( size_t c = 0; c < first.channels(); ++c ) {
+        fprintf(out, " %12s |t| %13s", first.channel_name(c), "|t|/sqrt(s)");
+    }
+    fprintf(out, "\n");
+
+    std::vector<size_t> best(first.channels(), 0);
+    for ( size_t i = 0; i < cell_results.size(); ++i ) {
+        cell_result_t const &result = cell_results[i];
+        plan_cell_t const   &cell   = plan.cells()[i];
+        fprintf(out, "%-20s %8u %10zu %10.1f", experiment_plan::name(cell).c_str(), cell.duration_us, result.analysis.pairs(), result.seconds);
+        for ( size_t c = 0; c < first.channels(); ++c ) {
+            double efficiency = result.seconds > 0 ? std::fabs(result.analysis.t(c)) / std::sqrt(result.seconds) : 0;
+            fprintf(out, " %16.2f %13.4f", std::fabs(result.analysis.t(c)), efficiency);
+
+            cell_result_t const &other = cell_results[best[c]];
+            if ( other.seconds <= 0 || (result.seconds > 0 && efficiency > std::fabs(other.analysis.t(c)) / std::sqrt(other.seconds)) ) {
+                best[c] = i;
+            }
+        }
+        fprintf(out, "\n");
+    }
+    for ( size_t c = 0; c < first.channels(); ++c ) {
+        plan_cell_t const &cell = plan.cells()[best[c]];
+        if ( !cell_results[best[c]].analysis.t(c) ) {
+            continue;
+        }
+        fprintf(out, "most efficient for %s: %s with %u us\n", first.channel_name(c), experiment_plan::name(cell).c_str(), cell.duration_us);
+    }
+}
+
+// SL_RESUME=1: feeds the batches already in the output to the analyses. Every batch has to be the one the plan
+// schedules at its index, otherwise the plan changed and the capture cannot be continued
+bool replay_batches(char const *path, npy_writer const &log, online_analysis &analysis) {
+    uint64_t batches = log.resumed_rows() / plan.rows;
+    if ( !batches ) {
+        return true;
+    }
+    int input = open(path, O_RDONLY);
+    if ( input < 0 ) {
+        perror("resume");
+        return false;
+    }
+    std::vector<row_t> batch(plan.rows);
+    size_t             size = plan.rows * sizeof(row_t);
+    bool               ok   = true;
+    for ( uint64_t index = 0; ok && index < batches; ++index ) {
+        if ( pread(input, batch.data(), size, log.data_offset() + index * size) != (ssize_t)size ) {
+            perror("resume");
+            ok = false;
+            break;
+        }
+        size_t             cell = plan.cell(index);
+        std::string        exp  = experiment_plan::name(plan.cells()[cell]);
+        for ( row_t const &row : batch ) {
+            if ( row.dur != plan.cells()[cell].duration_us || strncmp(row.exp, exp.c_str(), sizeof(row.exp)) ) {
+                printf("batch %zu was captured with another plan, cannot resume\n", index);
+                ok = false;
+                break;
+            }
+            cell_results[cell].seconds += row.dur * 1e-6;
+        }
+        analysis.add(batch.data(), plan.rows);
+        cell_results[cell].analysis.add(batch.data(), plan.rows);
+    }
+    close(input);
+    if ( ok ) {
+        printf("resumed after %zu batches\n", batches);
+    }
+    return ok;
+}
+
+// the pidfd of an exited child is readable, one poll covers all instances
 bool check_children() {
-    return std::all_of(id_attacker.begin(), id_attacker.end(), [](thread_id const &x) {
-        return x.pid != waitpid(x.pid, NULL, WNOHANG);
-    });
+    std::array<pollfd, NUMBER_ATTACKERS> fds;
+    for ( size_t i = 0; i < NUMBER_ATTACKERS; ++i ) {
+        fds[i] = { .fd = id_attacker[i].pidfd, .events = POLLIN, .revents = 0 };
+    }
+    return poll(fds.data(), fds.size(), 0) == 0;
 }
 
 void cleanup_children() {
     printf("stopping children!\n");
 
     for ( thread_id &tid : id_attacker ) {
-        kill(tid.pid, SIGKILL);
+        if ( tid.pidfd < 0 ) {
+            continue;
+        }
+        syscall(SYS_pidfd_send_signal, tid.pidfd, SIGKILL, nullptr, 0);
         waitpid(tid.pid, nullptr, 0);
+        close(tid.pidfd);
+        tid.pidfd = -1;
     }
 }
 
+// set by SIGINT, the capture stops after the current row and main cleans up (the output files are completed by the
+// destructors of the writers)
+volatile sig_atomic_t stop_requested = 0;
+
 void signal_handler(int signum) {
-    if ( signum == SIGUSR1 ) {
-        return;
+    stop_requested = 1;
+}
+
+std::unique_ptr<backend_t> make_backend() {
+    char const *name = getenv("SL_BACKEND");
+    name             = name ? name : "module";
+
+    if ( !strcmp(name, "module") ) {
+        auto module = std::make_unique<module_backend>();
+        return module->open("/dev/" XSTR(NAME)) ? std::move(module) : nullptr;
     }
-    cleanup_children();
-    exit(0);
+    if ( !strcmp(name, "perf") ) {
+        auto perf = std::make_unique<perf_backend>(core_controller);
+        return perf->open() ? std::move(perf) : nullptr;
+    }
+    if ( !strcmp(name, "mock") ) {
+        return std::make_unique<mock_backend>();
+    }
+    printf("unknown backend %s (module, perf or mock)\n", name);
+    return nullptr;
 }
 
 // pin pthread to specific core
@@ -189,33 +458,80 @@ uint8_t pin_to_exact_thread_pthread(pthread_t thread, uint8_t core) {
 int main(int argc, char *argv[]) {
 
     if ( argc < 2 ) {
-        printf("usage: %s output_file\n", argv[0]);
+        printf("usage: %s output_file [sample_period_us]\n", argv[0]);
+        return -1;
+    }
+
+    // with a sample period, the module streams samples instead of measuring each row with an ioctl
+    uint64_t sample_period_us = argc > 2 ? strtoull(argv[2], nullptr, 0) : 0;
+
+    env_setup();
+
+    // loop variant of the attackers without a plan (SL_VARIANT=pf|ref|rsb), see collide_power.c
+    if ( getenv("SL_VARIANT") && !plan.set_variant(getenv("SL_VARIANT")) ) {
+        return -1;
+    }
+    if ( getenv("SL_PLAN") ? !plan.load(getenv("SL_PLAN")) : !plan.validate() ) {
+        return -1;
+    }
+    core_controller = plan.controller;
+    cell_results    = std::vector<cell_result_t>(plan.cells().size());
+    printf("plan: %zu cells, %zu batches of %zu rows\n", plan.cells().size(), plan.batches, plan.rows);
+
+    bool resume = getenv("SL_RESUME") && atoi(getenv("SL_RESUME"));
+    if ( resume && sample_period_us ) {
+        printf("stream mode cannot resume!\n");
+        return -1;
+    }
+
+    backend = make_backend();
+    if ( !backend ) {
+        return -1;
+    }
+    printf("backend: %s\n", backend->name());
+
+    // SL_MSRS=<file>: registers read around every window next to the fixed counters, see msr_list.h
+    msr_descriptors msrs;
+    if ( getenv("SL_MSRS") && !msrs.load(getenv("SL_MSRS"), MSR_COLUMNS) ) {
+        return -1;
+    }
+    std::vector<std::string> fields = row_t_fields(msrs.list());
+    if ( !unique_fields(fields) ) {
         return -1;
     }
 
-    auto aes_attacker = create_shm_keys(SHM_ATTACKER);
-    auto aes_victim   = create_shm_keys(SHM_VICTIM);
+    if ( sample_period_us && !backend->streams() ) {
+        printf("stream mode needs the module backend!\n");
+        return -1;
+    }
 
-    if ( !aes_attacker || !aes_victim ) {
+    if ( backend->attackers() && !place_attackers() ) {
         return -2;
     }
 
-    // we open exactly our kernel module which is named after the parent's parent folder
-    fd = open("/dev/" XSTR(NAME), O_RDWR);
-    if ( fd < 0 ) {
-        printf("cannot open kernel module is it loaded? forgot sudo? %s\n", "/dev/" XSTR(NAME));
-        cleanup_children();
+    if ( backend->attackers() ) {
+        pin_to_exact_thread_pthread(pthread_self(), core_controller);
+    }
+
+    // the module checks the registers on the cpu of the upload, the windows read them on the controller core
+    if ( msrs.list().count && !backend->set_msrs(msrs.list()) ) {
         return -1;
     }
 
-    for ( thread_id &tid : id_attacker ) {
-        fork_exec(tid, "../../pf/collide_power");
-        printf("attacker: %ld\n", tid.pid);
+    control_block *control = control_create(SHM_CONTROL, NUMBER_ATTACKERS);
+    if ( !control ) {
+        return -2;
     }
 
-    usleep(1'500'000);
+    for ( size_t i = 0; i < NUMBER_ATTACKERS && backend->attackers(); ++i ) {
+        thread_id &tid = id_attacker[i];
+        char       instance[10];
+        snprintf(instance, sizeof(instance), "%zu", i);
+        fork_exec(tid, "../../pf/collide_power", instance, VARIANT_NAMES[plan.cells()[plan.cell(0)].variant]);
+        printf("attacker: %ld on core %d\n", tid.pid, tid.core_id);
+    }
 
-    if ( !check_children() ) {
+    if ( backend->attackers() && (control_wait_ready(control, NUMBER_ATTACKERS, READY_TIMEOUT_MS) || !check_children()) ) {
         printf("child died during init!\n");
         cleanup_children();
         return -1;
@@ -223,64 +539,166 @@ int main(int argc, char *argv[]) {
 
     printf("created processes!\n");
 
-    FILE *log = fopen(argv[1], "w");
-    if ( !log ) {
+    // the environment of this session comes first, a resumed file gets it replaced
+    char environment[ENV_METADATA_SIZE];
+    env_metadata(environment, sizeof(environment));
+    std::string metadata = msrs.metadata().empty() ? environment : environment + (" " + msrs.metadata());
+
+    npy_writer log(argv[1], npy_file { metadata, fields, strlen(environment) }, WRITE_CADENCE, sizeof(row_t), resume ? plan.rows : 0);
+    if ( !log.is_open() ) {
+        perror("open output");
         cleanup_children();
         return -1;
     }
 
-    if ( signal(SIGUSR1, signal_handler) ) {
+    if ( signal(SIGINT, signal_handler) == SIG_ERR ) {
         printf("sigaction failed!\n");
         cleanup_children();
         return -1;
     }
 
-    if ( signal(SIGINT, signal_handler) ) {
-        printf("sigaction failed!\n");
-        cleanup_children();
-        return -1;
+    std::unique_ptr<npy_writer> samples_log;
+    if ( sample_period_us ) {
+        std::string samples_name = std::string(argv[1]) + ".samples.npy";
+        samples_log              = std::make_unique<npy_writer>(samples_name.c_str(), npy_file { "", sample_t_fields }, WRITE_CADENCE, sizeof(sample_t));
+
+        void *mapping = mmap(nullptr, SAMPLER_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if ( !samples_log->is_open() || mapping == MAP_FAILED ) {
+            perror("stream mode");
+            cleanup_children();
+            return -1;
+        }
+        ring         = (sampler_header *)mapping;
+        ring_samples = (sample_t *)((uint8_t *)mapping + SAMPLER_HEADER_SIZE);
+
+        // sample the core of the attacker (APERF / MPERF are per core)
+        sampler_config config = { .period_ns = sample_period_us * 1000, .cpu = id_attacker[0].core_id };
+        if ( ioctl(fd, SAMPLER_START, &config) < 0 ) {
+            perror("SAMPLER_START");
+            cleanup_children();
+            return -1;
+        }
     }
 
-    npy_file numpy = { "", row_t_fields };
+    online_analysis analysis(STOP_CONFIDENCE);
 
-    pin_to_exact_thread_pthread(pthread_self(), core_controller);
+    if ( !replay_batches(argv[1], log, analysis) ) {
+        cleanup_children();
+        return -1;
+    }
 
-    numpy.write_header(log);
+    for ( uint64_t index = log.resumed_rows() / plan.rows; index < plan.batches; ++index ) {
 
-    for ( uint64_t index = 0; index < NUMBER_SAMPLES; ++index ) {
+        print_iteration(index, analysis);
 
-        print_iteration(index);
+        auto                start = std::chrono::steady_clock::now();
+        size_t              cell  = plan.cell(index);
+        npy_writer::block_t block = log.acquire();
+        block.data.assign(sizeof(row_t) * plan.rows, 0);
+        block.rows = plan.rows;
+        rows       = (row_t *)block.data.data();
 
-        generate_state();
+        generate_state(plan.cells()[cell], index);
 
         // repeat random selected variables for REP times
-        for ( size_t e = 0; e < EXPERIMENT_REPEAT; ++e ) {
+        for ( size_t e = 0; e < plan.rows && !stop_requested; ++e ) {
             rows[e].time = time(NULL);
 
-            static_assert(sizeof(rows[e].guess) == 16 * 12);
+            static_assert(sizeof(rows[e].guess) == CONTROL_PAYLOAD_SIZE);
+            static_assert(sizeof(rows[e].value) == CONTROL_PAYLOAD_SIZE);
+
+            // the attackers poll for the new state at their next loop boundary and wait for each other, measure only once
+            // all of them applied it
+            uint32_t sequence = control_publish(control, rows[e].guess, rows[e].value, plan.cells()[cell].bytes, plan.cells()[cell].variant);
+            if ( backend->attackers() && control_wait_ack(control, sequence, ACK_TIMEOUT_MS) ) {
+                printf("attackers did not apply the new state!\n");
+                cleanup_children();
+                return -1;
+            }
+
+            backend->state(rows[e].guess, rows[e].value);
 
-            memcpy(aes_attacker, rows[e].guess, sizeof(rows[e].guess));
-            memcpy(aes_victim, rows[e].value, sizeof(rows[e].value));
+            std::array<control_telemetry, NUMBER_ATTACKERS> before;
+            for ( size_t n = 0; n < NUMBER_ATTACKERS; ++n ) {
+                before[n] = control_read_telemetry(control, n);
+            }
 
-            // notify the attacker that new data is available
-            for ( thread_id &tid : id_attacker ) {
-                kill(tid.pid, SIGUSR1);
+            uint64_t trace = trace_begin();
+            if ( ring ) {
+                // epoch 0 marks samples taken between states
+                stream_one_sample(rows[e].measurements, index * plan.rows + e + 1, rows[e].dur);
+            } else {
+                record_one_sample(rows[e]);
             }
+            trace_end(TRACE_PROBE, trace);
+
+            // the attackers publish at loop boundaries, so the counts are exact up to one poll interval
+            for ( size_t n = 0; n < NUMBER_ATTACKERS; ++n ) {
+                control_telemetry after = control_read_telemetry(control, n);
+                rows[e].attackers[n]    = {
+                       .iterations = after.iterations - before[n].iterations,
+                       .hits       = after.hits - before[n].hits,
+                       .sequence   = after.sequence,
+                       .variant    = after.variant,
+                };
+            }
+        }
 
-            record_one_sample(rows[e].measurements);
+        // an interrupted batch is incomplete, it is dropped (a resume measures it again)
+        if ( stop_requested ) {
+            printf("\ninterrupted after %zu batches\n", index);
+            break;
         }
 
-        numpy.write_rows(log, (uint8_t *)rows, sizeof(rows), EXPERIMENT_REPEAT);
-        fsync(fileno(log));
+        // the analysis reads the rows before they are handed to the writer thread
+        analysis.add(rows, plan.rows);
+        cell_results[cell].analysis.add(rows, plan.rows);
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        cell_results[cell].seconds += std::max(wall, plan.rows * plan.cells()[cell].duration_us * 1e-6);
+
+        uint64_t trace = trace_begin();
+        bool written = log.submit(std::move(block));
+        if ( ring ) {
+            __atomic_store_n(&ring->epoch, 0, __ATOMIC_RELEASE);
+            drain_samples();
+            npy_writer::block_t samples_block = samples_log->acquire();
+            samples_block.data.assign((uint8_t *)samples.data(), (uint8_t *)(samples.data() + samples.size()));
+            samples_block.rows = samples.size();
+            written = samples_log->submit(std::move(samples_block)) && written;
+            samples.clear();
+        }
+        trace_end(TRACE_IO, trace);
+
+        if ( !written ) {
+            printf("writing the output failed: %s\n", strerror(log.error() ? log.error() : samples_log->error()));
+            cleanup_children();
+            return -1;
+        }
 
         if ( !check_children() ) {
             printf("child died during run!\n");
             cleanup_children();
             return -1;
         }
+
+        if ( cells_significant() ) {
+            printf("\nsignificant after %zu batches, stopping\n", index + 1);
+            break;
+        }
     }
 
     printf("\n");
+    analysis.print_report(stdout);
+    print_cells(stdout);
+
+    if ( ring ) {
+        ioctl(fd, SAMPLER_STOP);
+        if ( ring->dropped ) {
+            printf("sampler dropped %llu samples\n", (unsigned long long)ring->dropped);
+        }
+    }
+
+    cleanup_children();
 
     return 0;
 }
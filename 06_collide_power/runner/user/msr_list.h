@@ -0,0 +1,182 @@
+#pragma once
+
+#include "../module/interface.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// MSR descriptor list (SL_MSRS=<file>): registers read around every window in addition to the fixed counters, see
+// MSR_LIST_SET in the module interface. One descriptor per line, # starts a comment:
+//
+//   <name> <msr | tsc> <diff | begin | end> [shift] [bits]
+//
+//   C6Res      0x3FD  diff                 core C6 residency during the window
+//   PkgC6Res   0x3F9  diff
+//   PerfLimit  0x64F  end    0  16         core perf limit reasons after the window
+//   PkgEnergy  0x611  diff   0  32         wraps at 32 bit like the fixed Energy column
+//
+// The name becomes the npy column of the descriptor (u8), the whole list goes into the metadata of the npy header, so
+// the output describes which registers its columns hold.
+class msr_descriptors {
+    msr_list_t list_ = {};
+
+    static char const *kind_name(uint8_t kind) {
+        switch ( kind ) {
+            case MSR_KIND_DIFF:
+                return "diff";
+            case MSR_KIND_BEGIN:
+                return "begin";
+            default:
+                return "end";
+        }
+    }
+
+    static bool parse_kind(std::string const &name, uint8_t &kind) {
+        for ( kind = MSR_KIND_DIFF; kind <= MSR_KIND_END; ++kind ) {
+            if ( name == kind_name(kind) ) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // letters, digits and _, so the name works as npy column and inside the metadata
+    static bool valid_name(std::string const &name) {
+        if ( name.empty() || name.size() >= MSR_NAME_SIZE ) {
+            return false;
+        }
+        for ( char c : name ) {
+            if ( !isalnum((unsigned char)c) && c != '_' ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the whole text as number (decimal, 0x hex or 0 octal) of at most max
+    static bool parse_number(std::string const &text, uint64_t max, uint64_t &value) {
+        // strtoull would accept a sign and negate
+        if ( text.empty() || !isdigit((unsigned char)text[0]) ) {
+            return false;
+        }
+        char *end = nullptr;
+        errno     = 0;
+        unsigned long long parsed = strtoull(text.c_str(), &end, 0);
+        if ( errno || *end || parsed > max ) {
+            return false;
+        }
+        value = parsed;
+        return true;
+    }
+
+  public:
+    bool load(char const *path, size_t capacity) {
+        FILE *file = fopen(path, "r");
+        if ( !file ) {
+            perror("msr list");
+            return false;
+        }
+        list_ = {};
+
+        char line[256];
+        bool ok = true;
+        while ( ok && fgets(line, sizeof(line), file) ) {
+            std::string text = line;
+            std::stringstream fields(text.substr(0, text.find('#')));
+            std::string       name, msr, kind, shift_text = "0", bits_text = "0", extra;
+            if ( !(fields >> name) ) {
+                continue;
+            }
+            fields >> msr >> kind;
+            if ( fields >> shift_text ) {
+                fields >> bits_text;
+            }
+            uint64_t number = 0, shift = 0, bits = 0;
+
+            if ( list_.count == capacity ) {
+                printf("msr list: at most %zu descriptors\n", capacity);
+                ok = false;
+                break;
+            }
+            msr_desc_t &desc = list_.desc[list_.count];
+            if ( !valid_name(name) ) {
+                printf("msr list: invalid name %s\n", name.c_str());
+                ok = false;
+            } else if ( msr.empty() || !parse_kind(kind, desc.kind) ) {
+                printf("msr list: %s needs a register and diff, begin or end\n", name.c_str());
+                ok = false;
+                // the largest register number is taken by the tsc pseudo register
+            } else if ( msr != "tsc" && !parse_number(msr, MSR_DESC_TSC - 1, number) ) {
+                printf("msr list: invalid register %s of %s\n", msr.c_str(), name.c_str());
+                ok = false;
+            } else if ( !parse_number(shift_text, 63, shift) || !parse_number(bits_text, 64, bits) ) {
+                printf("msr list: invalid field of %s\n", name.c_str());
+                ok = false;
+            } else if ( fields >> extra ) {
+                printf("msr list: unexpected %s after %s\n", extra.c_str(), name.c_str());
+                ok = false;
+            }
+            for ( uint32_t i = 0; ok && i < list_.count; ++i ) {
+                if ( name == list_.desc[i].name ) {
+                    printf("msr list: %s twice\n", name.c_str());
+                    ok = false;
+                }
+            }
+            desc.msr   = msr == "tsc" ? MSR_DESC_TSC : number;
+            desc.shift = shift;
+            desc.bits  = bits;
+            strncpy(desc.name, name.c_str(), sizeof(desc.name) - 1);
+            ++list_.count;
+        }
+        fclose(file);
+        return ok;
+    }
+
+    msr_list_t const &list() const {
+        return list_;
+    }
+
+    // same field extraction as the module (msr_field)
+    static uint64_t field(msr_desc_t const &desc, uint64_t value) {
+        value >>= desc.shift;
+        return desc.bits && desc.bits < 64 ? value & ((1ull << desc.bits) - 1) : value;
+    }
+
+    // value of a descriptor from its raw reads before and after the window
+    static uint64_t value(msr_desc_t const &desc, uint64_t begin, uint64_t end) {
+        switch ( desc.kind ) {
+            case MSR_KIND_DIFF:
+                return field(desc, field(desc, end) - field(desc, begin));
+            case MSR_KIND_BEGIN:
+                return field(desc, begin);
+            default:
+                return field(desc, end);
+        }
+    }
+
+    // "msrs: C6Res=0x3fd:diff:0:0 ...", stored as metadata of the npy file (empty without descriptors)
+    std::string metadata() const {
+        if ( !list_.count ) {
+            return "";
+        }
+        std::string text = "msrs:";
+        for ( uint32_t i = 0; i < list_.count; ++i ) {
+            msr_desc_t const &desc = list_.desc[i];
+            char              buffer[128];
+            if ( desc.msr == MSR_DESC_TSC ) {
+                snprintf(buffer, sizeof(buffer), " %s=tsc:%s:%u:%u", desc.name, kind_name(desc.kind), desc.shift, desc.bits);
+            } else {
+                snprintf(buffer, sizeof(buffer), " %s=%#x:%s:%u:%u", desc.name, desc.msr, kind_name(desc.kind), desc.shift, desc.bits);
+            }
+            text += buffer;
+        }
+        return text;
+    }
+};
@@ -1,5 +1,7 @@
 // npy hack by Andreas Kogler
 
+#pragma once
+
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
@@ -20,10 +22,13 @@ class npy_file {
     npy2_header header_;
     std::string dtype_descr_;
     size_t      shape_offset_;
+    size_t      metadata_offset_;
+    size_t      volatile_size_;
 
     uint64_t rows_ = 0;
 
-    constexpr static inline char const *SHAPE_STR = "'shape': ( ";
+    constexpr static inline char const *SHAPE_STR    = "'shape': ( ";
+    constexpr static inline char const *METADATA_STR = "( ('''";
 
     static std::string generate_npy_header(std::string const &metadata, std::vector<std::string> const &fields) {
         std::stringstream ss;
@@ -63,7 +68,9 @@ class npy_file {
     }
 
   public:
-    npy_file(std::string metadata, std::vector<std::string> fields) {
+    // the first volatile_size characters of the metadata describe the session that wrote the file (e.g. the env
+    // metadata), they may differ when a file is resumed
+    npy_file(std::string metadata, std::vector<std::string> fields, size_t volatile_size = 0) : volatile_size_(volatile_size) {
 
         // get the dtype specifier
         dtype_descr_ = generate_npy_header(metadata, fields);
@@ -73,6 +80,26 @@ class npy_file {
 
         // find the offset of the shape field relative to the file start
         shape_offset_ = sizeof(npy2_header) + dtype_descr_.find(SHAPE_STR) + strlen(SHAPE_STR);
+
+        metadata_offset_ = sizeof(npy2_header) + dtype_descr_.find(METADATA_STR) + strlen(METADATA_STR);
+    }
+
+    // header and dtype specifier, the rows follow directly
+    std::string header() const {
+        return std::string((char const *)&header_, sizeof(npy2_header)) + dtype_descr_;
+    }
+
+    size_t shape_offset() const {
+        return shape_offset_;
+    }
+
+    // offset and size of the session part of the metadata relative to the file start
+    size_t volatile_offset() const {
+        return metadata_offset_;
+    }
+
+    size_t volatile_size() const {
+        return volatile_size_;
     }
 
     void write_header(FILE *file) {
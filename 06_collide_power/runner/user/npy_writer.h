@@ -0,0 +1,312 @@
+#pragma once
+
+#include "npy_file.h"
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// single producer, single consumer ring without locks. One side only writes head_, the other only tail_
+template<typename T, size_t N>
+class spsc_queue {
+    std::array<T, N> slots_;
+
+    alignas(64) std::atomic<size_t> head_ = 0;
+    alignas(64) std::atomic<size_t> tail_ = 0;
+
+  public:
+    bool push(T &&value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if ( head - tail_.load(std::memory_order_acquire) == N ) {
+            return false;
+        }
+        slots_[head % N] = std::move(value);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if ( tail == head_.load(std::memory_order_acquire) ) {
+            return false;
+        }
+        value = std::move(slots_[tail % N]);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// appends rows to an npy file on a background thread, so disk latency never lands between two measurement windows.
+//
+//   npy_writer writer(path, npy_file { "", fields }, cadence, sizeof(row));
+//   block_t block = writer.acquire();       // recycled buffer
+//   ... fill block.data, set block.rows ...
+//   if ( !writer.submit(std::move(block)) ) // returns immediately unless QUEUE_BLOCKS blocks are still pending
+//       ... writer.error() ...              // an earlier block could not be written
+//
+// The writer appends every queued block at once with pwritev. At most every cadence it syncs the data and then
+// rewrites the shape in place with pwrite, so the shape never counts rows that are not in the file yet and a
+// concurrent reader always sees a valid npy file (with at most cadence worth of rows missing). The destructor writes
+// everything that is left.
+//
+// If a write fails, the writer keeps the file at the last complete block and drops every later block, so the rows in
+// the file never skip a block. The error shows up in the next submit and in the destructor.
+class npy_writer {
+  public:
+    struct block_t {
+        std::vector<uint8_t> data;
+        size_t               rows = 0;
+    };
+
+  private:
+    static constexpr size_t QUEUE_BLOCKS = 16;
+
+    npy_file                  npy_;
+    int                       fd_;
+    std::chrono::milliseconds cadence_;
+
+    spsc_queue<block_t, QUEUE_BLOCKS> pending_;
+    spsc_queue<block_t, QUEUE_BLOCKS> free_;
+
+    // submitted / written blocks, the threads wait on them when idle or when the queue is full
+    std::atomic<uint64_t> submitted_ = 0;
+    std::atomic<uint64_t> written_   = 0;
+    std::atomic<bool>     stop_      = false;
+    // errno of the first failed write, later blocks are dropped
+    std::atomic<int>      error_     = 0;
+
+    // only touched by the writer thread (after the constructor)
+    uint64_t offset_ = 0;
+    uint64_t rows_   = 0;
+
+    uint64_t resumed_rows_ = 0;
+
+    std::thread thread_;
+
+    // the shape field has room for far more digits, the padding overwrites a longer old value (after a resume)
+    static constexpr size_t SHAPE_WIDTH = 20;
+
+    void update_shape() {
+        fdatasync(fd_);
+        std::string shape = std::to_string(rows_);
+        shape.resize(SHAPE_WIDTH, ' ');
+        if ( pwrite(fd_, shape.data(), shape.size(), npy_.shape_offset()) != (ssize_t)shape.size() ) {
+            perror("npy_writer: shape");
+        }
+    }
+
+    void run() {
+        auto last  = std::chrono::steady_clock::now();
+        bool dirty = false;
+        for ( ;; ) {
+            uint64_t seen = submitted_.load(std::memory_order_acquire);
+
+            // everything that queued up goes out in one write
+            std::array<block_t, QUEUE_BLOCKS> blocks;
+            std::array<iovec, QUEUE_BLOCKS>   vectors;
+            size_t                            count = 0, bytes = 0;
+            while ( count < QUEUE_BLOCKS && pending_.pop(blocks[count]) ) {
+                vectors[count] = { blocks[count].data.data(), blocks[count].data.size() };
+                bytes += blocks[count].data.size();
+                ++count;
+            }
+
+            if ( count && !error_.load(std::memory_order_relaxed) ) {
+                size_t done = 0;
+                while ( done < bytes ) {
+                    // pwritev may write less than asked for, continue after the written part
+                    size_t first = 0, skip = done;
+                    while ( skip >= vectors[first].iov_len ) {
+                        skip -= vectors[first++].iov_len;
+                    }
+                    iovec  rest[QUEUE_BLOCKS];
+                    size_t left = 0;
+                    for ( size_t i = first; i < count; ++i ) {
+                        rest[left++] = vectors[i];
+                    }
+                    rest[0].iov_base = (uint8_t *)rest[0].iov_base + skip;
+                    rest[0].iov_len -= skip;
+
+                    ssize_t written = pwritev(fd_, rest, left, offset_ + done);
+                    if ( written <= 0 ) {
+                        error_.store(written < 0 && errno ? errno : EIO, std::memory_order_release);
+                        perror("npy_writer: data");
+                        break;
+                    }
+                    done += written;
+                }
+                // after a failed write, only the blocks that went out completely count
+                size_t complete = 0;
+                for ( size_t i = 0; i < count && complete + blocks[i].data.size() <= done; ++i ) {
+                    complete += blocks[i].data.size();
+                    rows_ += blocks[i].rows;
+                }
+                offset_ += complete;
+                dirty = dirty || complete;
+            }
+            if ( count ) {
+                for ( size_t i = 0; i < count; ++i ) {
+                    free_.push(std::move(blocks[i]));
+                }
+                written_.fetch_add(count, std::memory_order_release);
+                written_.notify_all();
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if ( dirty && now - last >= cadence_ ) {
+                update_shape();
+                last  = now;
+                dirty = false;
+            }
+
+            if ( !count ) {
+                if ( stop_.load(std::memory_order_acquire) && submitted_.load(std::memory_order_acquire) == seen ) {
+                    break;
+                }
+                // sleeps until the next submit, wakes up at the latest after cadence to update the shape
+                if ( dirty ) {
+                    std::this_thread::sleep_for(std::min<std::chrono::milliseconds>(cadence_, std::chrono::milliseconds(10)));
+                } else {
+                    submitted_.wait(seen, std::memory_order_acquire);
+                }
+            }
+        }
+        update_shape();
+    }
+
+    // continues an existing file with the same header: keeps its first rows (the shape, rounded down to a multiple of
+    // batch) and drops everything after them
+    bool resume(size_t row_size, size_t batch) {
+        std::string header = npy_.header();
+        std::string existing(header.size(), '\0');
+        if ( pread(fd_, existing.data(), existing.size(), 0) != (ssize_t)existing.size() ) {
+            printf("npy_writer: cannot read the header to resume\n");
+            return false;
+        }
+        rows_ = strtoull(existing.c_str() + npy_.shape_offset(), nullptr, 10);
+
+        // the header may only differ in the shape and the session part of the metadata, which is then replaced
+        std::string shape   = std::to_string(rows_);
+        std::string session = header.substr(npy_.volatile_offset(), npy_.volatile_size());
+        header.replace(npy_.shape_offset(), shape.size(), shape);
+        header.replace(npy_.volatile_offset(), session.size(), existing, npy_.volatile_offset(), session.size());
+        if ( header != existing ) {
+            printf("npy_writer: the existing file has other fields, cannot resume\n");
+            return false;
+        }
+        if ( pwrite(fd_, session.data(), session.size(), npy_.volatile_offset()) != (ssize_t)session.size() ) {
+            perror("npy_writer: header");
+            return false;
+        }
+
+        rows_ -= rows_ % batch;
+        resumed_rows_ = rows_;
+        offset_       = header.size() + rows_ * row_size;
+        if ( ftruncate(fd_, offset_) ) {
+            perror("npy_writer: truncate");
+            return false;
+        }
+        update_shape();
+        return true;
+    }
+
+  public:
+    // resume_batch 0 creates a new file, otherwise an existing one is continued (see resume)
+    npy_writer(char const *path, npy_file npy, std::chrono::milliseconds cadence, size_t row_size, size_t resume_batch = 0)
+        : npy_(std::move(npy)), fd_(::open(path, O_RDWR | O_CREAT | (resume_batch ? 0 : O_TRUNC), 0644)), cadence_(cadence) {
+        if ( fd_ < 0 ) {
+            return;
+        }
+
+        struct stat info;
+        if ( resume_batch && !fstat(fd_, &info) && info.st_size ) {
+            if ( !resume(row_size, resume_batch) ) {
+                close(fd_);
+                fd_ = -1;
+                return;
+            }
+        } else {
+            std::string header = npy_.header();
+            if ( pwrite(fd_, header.data(), header.size(), 0) != (ssize_t)header.size() ) {
+                perror("npy_writer: header");
+            }
+            offset_ = header.size();
+        }
+        thread_ = std::thread(&npy_writer::run, this);
+    }
+
+    npy_writer(npy_writer const &) = delete;
+
+    ~npy_writer() {
+        if ( thread_.joinable() ) {
+            stop_.store(true, std::memory_order_release);
+            submitted_.fetch_add(1, std::memory_order_release);
+            submitted_.notify_one();
+            thread_.join();
+        }
+        if ( int error = error_.load(std::memory_order_acquire) ) {
+            printf("npy_writer: stopped writing after %llu rows: %s\n", (unsigned long long)rows_, strerror(error));
+        }
+        if ( fd_ >= 0 ) {
+            close(fd_);
+        }
+    }
+
+    bool is_open() const {
+        return fd_ >= 0;
+    }
+
+    // rows already in the file when it was resumed
+    uint64_t resumed_rows() const {
+        return resumed_rows_;
+    }
+
+    // offset of the first row
+    size_t data_offset() const {
+        return npy_.header().size();
+    }
+
+    // a written block, or a new one while all blocks are still in flight
+    block_t acquire() {
+        block_t block;
+        if ( !free_.pop(block) ) {
+            block = {};
+        }
+        block.rows = 0;
+        return block;
+    }
+
+    // errno of the first failed write, 0 if everything so far was written
+    int error() const {
+        return error_.load(std::memory_order_acquire);
+    }
+
+    // false once a write failed (see error), the block is dropped then
+    bool submit(block_t &&block) {
+        if ( error() ) {
+            return false;
+        }
+        // back pressure: only if the disk is slower than the measurement for QUEUE_BLOCKS batches
+        for ( ;; ) {
+            uint64_t written = written_.load(std::memory_order_acquire);
+            if ( pending_.push(std::move(block)) ) {
+                break;
+            }
+            written_.wait(written, std::memory_order_acquire);
+        }
+        submitted_.fetch_add(1, std::memory_order_release);
+        submitted_.notify_one();
+        return true;
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "config.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// runtime experiment plan (SL_PLAN=<file>): sweeps window duration, byte count and loop variant within one capture.
+// Without a plan the runner measures the single cell of the compile-time defaults. A plan file has one key per line,
+// lists are separated by spaces, # starts a comment:
+//
+//   durations  = 1000 2000 5000 10000 20000   window per row in us (Dur, at most 65535)
+//   bytes      = 8 64                         bytes of guess / value (at most 192)
+//   variants   = rsb pf                       loop variants of the attackers (pf, ref, rsb)
+//   batches    = 300000                       batches of rows to capture
+//   rows       = 1000                         rows per batch (even, every batch measures one cell)
+//   controller = 5                            core of the runner
+//   seed       = 1                            seed of the schedule
+//
+// The batches run in rounds, every round measures each cell once in an order shuffled by seed and round, so slow
+// drift spreads over all cells. The schedule only depends on the plan, so a resumed capture continues with the batch
+// it stopped at. Exp of every row is "<variant>/<bytes>".
+
+// same order as enum variant in collide_power.c
+static char const *const VARIANT_NAMES[] = { "pf", "ref", "rsb" };
+
+constexpr uint32_t DEFAULT_DURATION_US = 10000;
+constexpr uint32_t DEFAULT_BYTES       = 64;
+constexpr uint32_t DEFAULT_VARIANT     = 2;
+constexpr uint8_t  DEFAULT_CONTROLLER  = 5;
+
+struct plan_cell_t {
+    uint32_t duration_us;
+    uint32_t bytes;
+    uint32_t variant;
+};
+
+class experiment_plan {
+    std::vector<plan_cell_t> cells_;
+
+    static bool parse_variant(std::string const &name, uint32_t &variant) {
+        for ( variant = 0; variant < std::size(VARIANT_NAMES); ++variant ) {
+            if ( name == VARIANT_NAMES[variant] ) {
+                return true;
+            }
+        }
+        printf("plan: unknown loop variant %s\n", name.c_str());
+        return false;
+    }
+
+  public:
+    std::vector<uint32_t> durations = { DEFAULT_DURATION_US };
+    std::vector<uint32_t> bytes     = { DEFAULT_BYTES };
+    std::vector<uint32_t> variants  = { DEFAULT_VARIANT };
+
+    uint64_t batches    = NUMBER_SAMPLES;
+    size_t   rows       = EXPERIMENT_REPEAT;
+    uint8_t  controller = DEFAULT_CONTROLLER;
+    uint64_t seed       = 0;
+
+    // variant of the single-cell default (SL_VARIANT)
+    bool set_variant(char const *name) {
+        return parse_variant(name, variants[0]);
+    }
+
+    bool load(char const *path) {
+        FILE *file = fopen(path, "r");
+        if ( !file ) {
+            perror("plan");
+            return false;
+        }
+        char line[1024];
+        bool ok = true;
+        while ( ok && fgets(line, sizeof(line), file) ) {
+            std::string text = line;
+            text             = text.substr(0, text.find('#'));
+            size_t equal     = text.find('=');
+            if ( equal == std::string::npos ) {
+                continue;
+            }
+            std::stringstream key_stream(text.substr(0, equal)), values(text.substr(equal + 1));
+            std::string       key;
+            key_stream >> key;
+
+            std::vector<std::string> list;
+            for ( std::string value; values >> value; ) {
+                list.push_back(value);
+            }
+            if ( list.empty() ) {
+                printf("plan: %s has no value\n", key.c_str());
+                ok = false;
+                break;
+            }
+
+            if ( key == "durations" || key == "bytes" ) {
+                std::vector<uint32_t> &target = key == "durations" ? durations : bytes;
+                target.clear();
+                for ( std::string const &value : list ) {
+                    target.push_back(strtoul(value.c_str(), nullptr, 0));
+                }
+            } else if ( key == "variants" ) {
+                variants.clear();
+                for ( std::string const &value : list ) {
+                    uint32_t variant = 0;
+                    ok = ok && parse_variant(value, variant);
+                    variants.push_back(variant);
+                }
+            } else if ( key == "batches" ) {
+                batches = strtoull(list[0].c_str(), nullptr, 0);
+            } else if ( key == "rows" ) {
+                rows = strtoull(list[0].c_str(), nullptr, 0);
+            } else if ( key == "controller" ) {
+                controller = strtoul(list[0].c_str(), nullptr, 0);
+            } else if ( key == "seed" ) {
+                seed = strtoull(list[0].c_str(), nullptr, 0);
+            } else {
+                printf("plan: unknown key %s\n", key.c_str());
+                ok = false;
+            }
+        }
+        fclose(file);
+        return ok && validate();
+    }
+
+    bool validate() {
+        for ( uint32_t duration : durations ) {
+            if ( !duration || duration > UINT16_MAX ) {
+                printf("plan: duration %u us does not fit into Dur\n", duration);
+                return false;
+            }
+        }
+        for ( uint32_t count : bytes ) {
+            if ( !count || count > sizeof(row_t {}.value) ) {
+                printf("plan: %u bytes, at most %zu\n", count, sizeof(row_t {}.value));
+                return false;
+            }
+        }
+        if ( !rows || rows % 2 ) {
+            printf("plan: rows has to be even\n");
+            return false;
+        }
+
+        cells_.clear();
+        for ( uint32_t duration : durations ) {
+            for ( uint32_t count : bytes ) {
+                for ( uint32_t variant : variants ) {
+                    cells_.push_back({ duration, count, variant });
+                }
+            }
+        }
+        return true;
+    }
+
+    std::vector<plan_cell_t> const &cells() const {
+        return cells_;
+    }
+
+    // index into cells() of the cell that batch measures
+    size_t cell(uint64_t batch) const {
+        uint64_t            round = batch / cells_.size();
+        std::vector<size_t> order(cells_.size());
+        for ( size_t i = 0; i < order.size(); ++i ) {
+            order[i] = i;
+        }
+        std::mt19937_64 random(seed * 0x9E3779B97F4A7C15ull + round);
+        std::shuffle(order.begin(), order.end(), random);
+        return order[batch % cells_.size()];
+    }
+
+    static std::string name(plan_cell_t const &cell) {
+        return std::string(VARIANT_NAMES[cell.variant]) + "/" + std::to_string(cell.bytes);
+    }
+};
@@ -0,0 +1,271 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+// shared-memory control block between a measurement runner and the processes it drives (C and C++).
+// Replaces "memcpy into shared memory + kill(SIGUSR1)": a signal enters the kernel in the middle of the measurement
+// window, runs the handler at an arbitrary point of the attacker loop and gives no guarantee that the new state was
+// applied before the measurement starts.
+//
+//   runner                                  attacker i of n
+//   control_create(name, n)                 control_open(name)
+//   control_wait_ready(block, n, ms)  <---  control_ready(block)            (futex, once at startup)
+//   control_publish(block, g, v, n, var)    loop: ... control_poll(block, &state) at a loop boundary
+//   control_wait_ack(block, sequence) <---        apply state, control_ack(block, i, state.sequence)
+//   measure                                       control_barrier(block, state.sequence)
+//
+// Next to guess and value, a state carries how many of their bytes are used and the loop variant the attackers should
+// run, so a runner can switch byte counts and variants within one capture.
+//
+// Every attacker also publishes telemetry at its loop boundaries (control_report): iterations, optional hit counts and
+// the sequence of the state it runs, so the runner can relate a measurement to the work done during it.
+//
+// With several attackers, every one acknowledges in its own slot and then waits in control_barrier until all of them
+// applied the state, so they resume their loops together and no attacker runs the old state while others already run
+// the new one.
+//
+// The payload is protected by a seqlock: the runner makes the sequence odd, writes, and makes it even again, the
+// attacker copies the payload and retries if the sequence changed meanwhile. Polling costs a single load of a line
+// that only changes once per sample, so the attacker never enters the kernel during a measurement. Sequence and
+// payload live on other cache lines than the ready / ack words the attackers write, so acks do not bounce the
+// payload line.
+
+#ifndef _GNU_SOURCE
+    #error "control.h needs _GNU_SOURCE (syscall)"
+#endif /* _GNU_SOURCE */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define CONTROL_PAYLOAD_SIZE 192
+#define CONTROL_MAX_ATTACKERS 16
+
+// written by one attacker at its loop boundaries, read by the runner around a measurement
+struct control_telemetry {
+    uint64_t iterations;
+    uint64_t hits;
+    // sequence of the applied state
+    uint32_t sequence;
+    // loop variant of the attacker
+    uint32_t variant;
+};
+
+struct control_block {
+    // written by the runner
+    uint32_t sequence;
+    uint32_t attackers;
+    uint32_t variant;
+    // used bytes of guess and value (at most CONTROL_PAYLOAD_SIZE)
+    uint32_t bytes;
+    uint8_t guess[CONTROL_PAYLOAD_SIZE];
+    uint8_t value[CONTROL_PAYLOAD_SIZE];
+
+    // written by the attackers, one line per ack and one per telemetry so they do not contend (the barrier spins on the
+    // acks, the telemetry changes every few iterations)
+    __attribute__((aligned(64))) uint32_t ready;
+    struct {
+        __attribute__((aligned(64))) uint32_t ack;
+        __attribute__((aligned(64))) struct control_telemetry telemetry;
+    } slots[CONTROL_MAX_ATTACKERS];
+};
+
+// copy of the payload as seen by the attacker
+struct control_state {
+    uint32_t sequence;
+    uint32_t variant;
+    uint32_t bytes;
+    uint8_t guess[CONTROL_PAYLOAD_SIZE];
+    uint8_t value[CONTROL_PAYLOAD_SIZE];
+};
+
+static inline uint64_t control_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static inline void control_relax(void) {
+    #if defined(__x86_64__)
+        asm volatile("pause");
+    #elif defined(__aarch64__)
+        asm volatile("yield");
+    #endif
+}
+
+static struct control_block* control_map(const char* name, int flags) {
+    int fd = shm_open(name, flags, S_IRUSR | S_IWUSR);
+    if(fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+    if((flags & O_CREAT) && ftruncate(fd, sizeof(struct control_block))) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+    void* addr = mmap(NULL, sizeof(struct control_block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return (struct control_block*) addr;
+}
+
+// runner: creates (and resets) the control block for the given number of attacker processes
+static struct control_block* control_create(const char* name, uint32_t attackers) {
+    if(attackers < 1 || attackers > CONTROL_MAX_ATTACKERS) {
+        fprintf(stderr, "control: %u attackers, at most %d supported\n", attackers, CONTROL_MAX_ATTACKERS);
+        return NULL;
+    }
+    struct control_block* block = control_map(name, O_RDWR | O_CREAT);
+    if(block) {
+        memset(block, 0, sizeof(*block));
+        block->attackers = attackers;
+    }
+    return block;
+}
+
+// attacker
+static struct control_block* control_open(const char* name) {
+    return control_map(name, O_RDWR);
+}
+
+// runner: publishes a new state and returns its sequence number (for control_wait_ack)
+static uint32_t control_publish(struct control_block* block, const uint8_t* guess, const uint8_t* value, uint32_t bytes, uint32_t variant) {
+    uint32_t sequence = block->sequence;
+    __atomic_store_n(&block->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&block->variant, variant, __ATOMIC_RELAXED);
+    __atomic_store_n(&block->bytes, bytes < CONTROL_PAYLOAD_SIZE ? bytes : CONTROL_PAYLOAD_SIZE, __ATOMIC_RELAXED);
+    memcpy(block->guess, guess, CONTROL_PAYLOAD_SIZE);
+    memcpy(block->value, value, CONTROL_PAYLOAD_SIZE);
+    __atomic_store_n(&block->sequence, sequence + 2, __ATOMIC_RELEASE);
+    return sequence + 2;
+}
+
+// attacker: copies the state if there is a new one, returns whether it did
+static inline int control_poll(struct control_block* block, struct control_state* state) {
+    uint32_t sequence = __atomic_load_n(&block->sequence, __ATOMIC_ACQUIRE);
+    if(__builtin_expect(sequence == state->sequence, 1)) {
+        return 0;
+    }
+    for(;;) {
+        if(sequence & 1) {
+            control_relax();
+            sequence = __atomic_load_n(&block->sequence, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        state->variant = __atomic_load_n(&block->variant, __ATOMIC_RELAXED);
+        state->bytes = __atomic_load_n(&block->bytes, __ATOMIC_RELAXED);
+        memcpy(state->guess, block->guess, CONTROL_PAYLOAD_SIZE);
+        memcpy(state->value, block->value, CONTROL_PAYLOAD_SIZE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint32_t check = __atomic_load_n(&block->sequence, __ATOMIC_RELAXED);
+        if(check == sequence) {
+            state->sequence = sequence;
+            return 1;
+        }
+        sequence = check;
+    }
+}
+
+// attacker: confirms that the state with this sequence number is applied
+static inline void control_ack(struct control_block* block, uint32_t index, uint32_t sequence) {
+    __atomic_store_n(&block->slots[index].ack, sequence, __ATOMIC_RELEASE);
+}
+
+// whether all attackers acknowledged sequence
+static inline int control_acked(struct control_block* block, uint32_t sequence) {
+    for(uint32_t i = 0; i < block->attackers; i ++) {
+        if(__atomic_load_n(&block->slots[i].ack, __ATOMIC_ACQUIRE) != sequence) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// attacker: waits until all attackers applied sequence. Gives up once the runner publishes a newer state, so a dead
+// attacker cannot stall the others for good (the runner notices its missing ack itself)
+static inline void control_barrier(struct control_block* block, uint32_t sequence) {
+    while(!control_acked(block, sequence) && __atomic_load_n(&block->sequence, __ATOMIC_RELAXED) == sequence) {
+        control_relax();
+    }
+}
+
+// attacker: publishes its telemetry (a loop boundary, no ordering needed, every field is read on its own)
+static inline void control_report(struct control_block* block, uint32_t index, uint64_t iterations, uint64_t hits, uint32_t variant) {
+    struct control_telemetry* telemetry = &block->slots[index].telemetry;
+    __atomic_store_n(&telemetry->iterations, iterations, __ATOMIC_RELAXED);
+    __atomic_store_n(&telemetry->hits, hits, __ATOMIC_RELAXED);
+    __atomic_store_n(&telemetry->sequence, block->slots[index].ack, __ATOMIC_RELAXED);
+    __atomic_store_n(&telemetry->variant, variant, __ATOMIC_RELAXED);
+}
+
+// runner: snapshot of the telemetry of attacker index
+static inline struct control_telemetry control_read_telemetry(struct control_block* block, uint32_t index) {
+    struct control_telemetry* telemetry = &block->slots[index].telemetry;
+    struct control_telemetry snapshot;
+    snapshot.iterations = __atomic_load_n(&telemetry->iterations, __ATOMIC_RELAXED);
+    snapshot.hits = __atomic_load_n(&telemetry->hits, __ATOMIC_RELAXED);
+    snapshot.sequence = __atomic_load_n(&telemetry->sequence, __ATOMIC_RELAXED);
+    snapshot.variant = __atomic_load_n(&telemetry->variant, __ATOMIC_RELAXED);
+    return snapshot;
+}
+
+// runner: spins until all attackers applied sequence. Returns -1 after timeout_ms (an attacker died or hangs)
+static int control_wait_ack(struct control_block* block, uint32_t sequence, uint64_t timeout_ms) {
+    uint64_t deadline = 0;
+    for(uint64_t spins = 0; !control_acked(block, sequence); spins ++) {
+        control_relax();
+        // the clock is only read every few thousand spins, the ack usually arrives within one attacker iteration.
+        // Yield now and then in case the attacker shares our core
+        if(!(spins & 0xfff)) {
+            sched_yield();
+            uint64_t now = control_now_ns();
+            if(!deadline) {
+                deadline = now + timeout_ms * 1000000ull;
+            } else if(now > deadline) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// attacker: signals the end of its setup (mapping, calibration)
+static void control_ready(struct control_block* block) {
+    __atomic_add_fetch(&block->ready, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &block->ready, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+// runner: sleeps until count attackers are ready. Returns -1 after timeout_ms
+static int control_wait_ready(struct control_block* block, uint32_t count, uint64_t timeout_ms) {
+    uint64_t deadline = control_now_ns() + timeout_ms * 1000000ull;
+    for(;;) {
+        uint32_t ready = __atomic_load_n(&block->ready, __ATOMIC_ACQUIRE);
+        if(ready >= count) {
+            return 0;
+        }
+        uint64_t now = control_now_ns();
+        if(now >= deadline) {
+            return -1;
+        }
+        struct timespec timeout = { .tv_sec = (time_t) ((deadline - now) / 1000000000ull), .tv_nsec = (long) ((deadline - now) % 1000000000ull) };
+        if(syscall(SYS_futex, &block->ready, FUTEX_WAIT, ready, &timeout, NULL, 0) && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+            perror("futex");
+            return -1;
+        }
+    }
+}
+
+#endif /* CONTROL_H */
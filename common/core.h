@@ -0,0 +1,378 @@
+#ifndef CORE_H
+#define CORE_H
+
+// measurement core shared by all harnesses (C and C++).
+// Before this header, probe / _rdtsc / flush / map_buffer / map_gadget / calculate_threshold / rand64 were copied
+// into every harness with small differences. The hot path is now defined once and specialized at compile time by
+// policies, so all harnesses measure with identical instruction sequences:
+//
+//   CORE_TIMER   x86_64:  CORE_TIMER_RDTSC (default), CORE_TIMER_RDTSCP, CORE_TIMER_APERF (rdpru, AMD)
+//                aarch64: CORE_TIMER_PMCCNTR (default), CORE_TIMER_CNTVCT
+//   CORE_FENCE   x86_64:  CORE_FENCE_MFENCE (default), CORE_FENCE_LFENCE
+//                aarch64: CORE_FENCE_DMB (default, DMB SY + ISB), CORE_FENCE_DSB (DSB SY + ISB)
+//   CORE_FLUSH   x86_64:  CORE_FLUSH_CLFLUSH (default), CORE_FLUSH_CLFLUSHOPT
+//                aarch64: DC CIVAC
+//   CORE_MACCESS CORE_MACCESS_BYTE (default, mov %al / ldrb), CORE_MACCESS_QWORD (mov %rax / ldr x0)
+//
+// Harnesses that always measured with a different load or fence keep it by defining the policy before the include
+// (01_shadowload: 64-bit loads and DSB, 04_meltdown: 64-bit loads).
+//
+// e.g. gcc -DCORE_TIMER=CORE_TIMER_RDTSCP -DCORE_FENCE=CORE_FENCE_LFENCE ...
+//
+// CORE_TRAIN replaces the runtime `access % accesses` training loops with fully unrolled sequences for every
+// access count up to CORE_TRAIN_MAX_UNROLL.
+//
+// The helpers map buffers and code (map_buffer, map_code, map_gadget) and calibrate the hit threshold. By default,
+// calculate_threshold self-probes memory. Harnesses that measure through their own probe (02_stride_re, through its
+// victim API) define CORE_CUSTOM_THRESHOLD and build their calculate_threshold on core_calibrate.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+
+#define CORE_TIMER_RDTSC 1
+#define CORE_TIMER_RDTSCP 2
+#define CORE_TIMER_APERF 3
+#define CORE_TIMER_PMCCNTR 4
+#define CORE_TIMER_CNTVCT 5
+
+#define CORE_FENCE_MFENCE 1
+#define CORE_FENCE_LFENCE 2
+#define CORE_FENCE_DMB 3
+#define CORE_FENCE_DSB 4
+
+#define CORE_FLUSH_CLFLUSH 1
+#define CORE_FLUSH_CLFLUSHOPT 2
+
+#define CORE_MACCESS_BYTE 1
+#define CORE_MACCESS_QWORD 2
+
+#ifndef CORE_MACCESS
+    #define CORE_MACCESS CORE_MACCESS_BYTE
+#endif /* CORE_MACCESS */
+
+#ifndef PAGE_SIZE
+    #define PAGE_SIZE 4096
+#endif /* PAGE_SIZE */
+#ifndef CACHE_LINE_SIZE
+    #define CACHE_LINE_SIZE 64
+#endif /* CACHE_LINE_SIZE */
+
+#if defined(__x86_64__)
+
+    #ifndef CORE_TIMER
+        #define CORE_TIMER CORE_TIMER_RDTSC
+    #endif /* CORE_TIMER */
+    #ifndef CORE_FENCE
+        #define CORE_FENCE CORE_FENCE_MFENCE
+    #endif /* CORE_FENCE */
+    #ifndef CORE_FLUSH
+        #define CORE_FLUSH CORE_FLUSH_CLFLUSH
+    #endif /* CORE_FLUSH */
+
+    #if CORE_MACCESS == CORE_MACCESS_BYTE
+        #define maccess(x) asm volatile("mov (%0), %%al" :: "r" (x) : "rax")
+    #elif CORE_MACCESS == CORE_MACCESS_QWORD
+        #define maccess(x) asm volatile("mov (%0), %%rax" :: "r" (x) : "rax")
+    #else
+        #error "unknown CORE_MACCESS"
+    #endif /* CORE_MACCESS */
+    #define nop() asm volatile("nop")
+
+    #if CORE_FENCE == CORE_FENCE_MFENCE
+        #define mfence() asm volatile("mfence" ::: "memory")
+    #elif CORE_FENCE == CORE_FENCE_LFENCE
+        #define mfence() asm volatile("lfence" ::: "memory")
+    #else
+        #error "unknown CORE_FENCE"
+    #endif /* CORE_FENCE */
+
+    #if CORE_FLUSH == CORE_FLUSH_CLFLUSH
+        #define flush(x) asm volatile("clflush (%0)" :: "r" (x))
+    #elif CORE_FLUSH == CORE_FLUSH_CLFLUSHOPT
+        #define flush(x) asm volatile("clflushopt (%0)" :: "r" (x))
+    #else
+        #error "unknown CORE_FLUSH"
+    #endif /* CORE_FLUSH */
+
+    // raw timer read without fences
+    static inline __attribute__((always_inline)) uint64_t core_timestamp(void) {
+        uint64_t a, d;
+        #if CORE_TIMER == CORE_TIMER_RDTSC
+            asm volatile("rdtsc" : "=a" (a), "=d" (d));
+        #elif CORE_TIMER == CORE_TIMER_RDTSCP
+            asm volatile("rdtscp" : "=a" (a), "=d" (d) :: "rcx");
+        #elif CORE_TIMER == CORE_TIMER_APERF
+            asm volatile("rdpru" : "=a" (a), "=d" (d) : "c" (1));
+        #else
+            #error "unknown CORE_TIMER for x86_64"
+        #endif /* CORE_TIMER */
+        return (d << 32) | a;
+    }
+
+#elif defined(__aarch64__)
+
+    #ifndef CORE_TIMER
+        #define CORE_TIMER CORE_TIMER_PMCCNTR
+    #endif /* CORE_TIMER */
+    #ifndef CORE_FENCE
+        #define CORE_FENCE CORE_FENCE_DMB
+    #endif /* CORE_FENCE */
+
+    #if CORE_MACCESS == CORE_MACCESS_BYTE
+        #define maccess(x) asm volatile("ldrb w0, [%0]" :: "r" (x) : "x0")
+    #elif CORE_MACCESS == CORE_MACCESS_QWORD
+        #define maccess(x) asm volatile("ldr x0, [%0]" :: "r" (x) : "x0")
+    #else
+        #error "unknown CORE_MACCESS"
+    #endif /* CORE_MACCESS */
+    #define nop() asm volatile("nop")
+
+    #if CORE_FENCE == CORE_FENCE_DMB
+        #define mfence() asm volatile("DMB SY\nISB" ::: "memory")
+    #elif CORE_FENCE == CORE_FENCE_DSB
+        #define mfence() asm volatile("DSB SY\nISB" ::: "memory")
+    #else
+        #error "unknown CORE_FENCE for aarch64"
+    #endif /* CORE_FENCE */
+    #define flush(x) asm volatile("DC CIVAC, %0" :: "r" (x))
+
+    static inline __attribute__((always_inline)) uint64_t core_timestamp(void) {
+        uint64_t a;
+        #if CORE_TIMER == CORE_TIMER_PMCCNTR
+            asm volatile("mrs %0, PMCCNTR_EL0" : "=r" (a));
+        #elif CORE_TIMER == CORE_TIMER_CNTVCT
+            asm volatile("mrs %0, CNTVCT_EL0" : "=r" (a));
+        #else
+            #error "unknown CORE_TIMER for aarch64"
+        #endif /* CORE_TIMER */
+        return a;
+    }
+
+#else
+    #error "unknown architecture. Only x86_64 and aarch64 are supported"
+#endif /* ARCHITECTURE */
+
+// fenced timer read, the name stayed from the x86-only days
+static inline __attribute__((always_inline)) uint64_t _rdtsc(void) {
+    mfence();
+    uint64_t a = core_timestamp();
+    mfence();
+    return a;
+}
+
+// measure time of memory load
+static inline __attribute__((always_inline)) uint64_t probe(void* addr) {
+    uint64_t start, end;
+    start = _rdtsc();
+    maccess(addr);
+    end = _rdtsc();
+    return end - start;
+}
+
+static void flush_region(uintptr_t start, size_t length) {
+    length += start & (CACHE_LINE_SIZE - 1);
+    start -= start & (CACHE_LINE_SIZE - 1);
+    for(uintptr_t offset = 0; offset < length; offset += CACHE_LINE_SIZE) {
+        flush((uint8_t*) start + offset);
+    }
+}
+
+static uint64_t seed = 42;
+
+static uint64_t rand64(void) {
+    return (seed = (164603309694725029ull * seed) % 14738995463583502973ull);
+}
+
+static int compare_int64(const void* a, const void* b) {
+    int64_t difference = *(const int64_t*) a - *(const int64_t*) b;
+    return (difference > 0) - (difference < 0);
+}
+
+
+/* training sequences */
+
+// number of unrolled cases in CORE_TRAIN
+#define CORE_TRAIN_MAX_UNROLL 16
+
+#define _CORE_PRAGMA(x) _Pragma(#x)
+
+// count is a constant here, so the loop is unrolled completely
+#define _CORE_TRAIN_CASE(n, access, ...) \
+    case n: { \
+        _CORE_PRAGMA(GCC unroll n) \
+        for(int access = 0; access < n; access++) { __VA_ARGS__; } \
+        break; \
+    }
+
+// runs the statement accesses times with access = 0 .. accesses - 1.
+// Every count up to CORE_TRAIN_MAX_UNROLL dispatches to a straight-line sequence, larger counts fall back to a loop.
+//   CORE_TRAIN(accesses, access, load(&buffer[access * stride]); mfence());
+#define CORE_TRAIN(accesses, access, ...) \
+    switch(accesses) { \
+        _CORE_TRAIN_CASE(1, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(2, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(3, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(4, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(5, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(6, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(7, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(8, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(9, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(10, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(11, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(12, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(13, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(14, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(15, access, __VA_ARGS__) \
+        _CORE_TRAIN_CASE(16, access, __VA_ARGS__) \
+        default: \
+            for(int access = 0; access < (int) (accesses); access++) { __VA_ARGS__; } \
+            break; \
+    }
+
+
+/* helpers */
+
+#include "warmup.h"
+
+typedef void (*load_gadget_f)(void*);
+
+// defined in the gadget.S of every harness (02_stride_re maps its own gadget through map_code)
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+void load_gadget_start(void* address);
+void load_gadget_end(void);
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+// failures of the helpers go through ERROR of harnesses with log macros (02_stride_re/tests/log.h, included first)
+#ifdef ERROR
+    #define CORE_ERROR(...) ERROR(__VA_ARGS__)
+#else
+    #define CORE_ERROR(...) fprintf(stderr, __VA_ARGS__)
+#endif /* ERROR */
+
+// maps size bytes (rounded up to whole pages) exactly at address, NULL if address is not page aligned or taken
+static uint8_t* map_buffer(uintptr_t address, uint64_t size) {
+    if(address % PAGE_SIZE) {
+        CORE_ERROR("buffer is not page aligned: 0x%016zx (size: %zu)\n", (size_t) address, (size_t) size);
+        return NULL;
+    }
+    if(size % PAGE_SIZE) {
+        size += PAGE_SIZE - size % PAGE_SIZE;
+    }
+    uint64_t trace = trace_begin();
+    void* mapping = mmap((void*) address, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE | MAP_FIXED_NOREPLACE, -1, 0);
+    trace_end(TRACE_MAPPING, trace);
+    if(mapping == MAP_FAILED) {
+        CORE_ERROR("failed to map buffer: 0x%016zx (size: %zu)\n", (size_t) address, (size_t) size);
+        return NULL;
+    }
+    if(mapping != (void*) address) {
+        CORE_ERROR("got wrong address for buffer: 0x%016zx (size: %zu) -> 0x%016zx\n", (size_t) address, (size_t) size, (size_t) mapping);
+        munmap(mapping, size);
+        return NULL;
+    }
+    return (uint8_t*) mapping;
+}
+
+// copies the code between start and end to address (mapping the two pages from the one of address) and makes it
+// executable
+static load_gadget_f map_code(uintptr_t address, const void* start, const void* end) {
+    uint8_t* mapping = map_buffer(address - (address % PAGE_SIZE), 2 * PAGE_SIZE);
+    if(!mapping) {
+        return NULL;
+    }
+    uint64_t trace = trace_begin();
+    memcpy((void*) address, start, (uintptr_t) end - (uintptr_t) start);
+    __builtin___clear_cache((char*) address, (char*) address + ((uintptr_t) end - (uintptr_t) start));
+    mprotect(mapping, 2 * PAGE_SIZE, PROT_READ | PROT_EXEC);
+    trace_end(TRACE_MAPPING, trace);
+    mapping += address % PAGE_SIZE;
+    return (load_gadget_f)(void*) mapping;
+}
+
+// copies the harness gadget (load_gadget_start .. load_gadget_end) to address
+static load_gadget_f map_gadget(uintptr_t address) {
+    return map_code(address, (const void*) load_gadget_start, (const void*) load_gadget_end);
+}
+
+// samples of each phase of core_calibrate
+#define CORE_CALIBRATION_SAMPLES 1000
+
+struct core_calibration {
+    uint64_t hit, miss;     // average hit / miss time
+    uint64_t threshold;     // 0 if hits and misses cannot be told apart
+    int hits, misses;       // correctly classified of CORE_CALIBRATION_SAMPLES hits / misses each (sanity check)
+};
+
+// threshold from the averages of measured hits and misses. measure(0) times a cached line, measure(1) evicts it
+// first. The threshold is placed closer to the hit average, but above it (for low resolution timers, both may be very
+// close), and then checked against new samples.
+static struct core_calibration core_calibrate(uint64_t (*measure)(int miss)) {
+    struct core_calibration calibration = { 0 };
+    uint64_t hit_sum = 0, miss_sum = 0;
+
+    // bring the line into the cache, then ignore outliers (interrupts, etc.)
+    measure(0);
+    for(int measured = 0; measured < CORE_CALIBRATION_SAMPLES;) {
+        uint64_t time = measure(0);
+        if(time && time < 1000) {
+            hit_sum += time;
+            measured ++;
+        }
+    }
+    for(int measured = 0; measured < CORE_CALIBRATION_SAMPLES;) {
+        uint64_t time = measure(1);
+        if(time && time < 1000) {
+            miss_sum += time;
+            measured ++;
+        }
+    }
+    calibration.hit = hit_sum / CORE_CALIBRATION_SAMPLES;
+    calibration.miss = miss_sum / CORE_CALIBRATION_SAMPLES;
+    if(calibration.hit >= calibration.miss) {
+        return calibration;
+    }
+
+    calibration.threshold = calibration.hit + (calibration.miss - calibration.hit) / 5;
+    if(calibration.threshold == calibration.hit) {
+        calibration.threshold ++;
+    }
+
+    measure(0);
+    for(int measured = 0; measured < CORE_CALIBRATION_SAMPLES; measured ++) {
+        calibration.hits += measure(0) < calibration.threshold;
+    }
+    for(int measured = 0; measured < CORE_CALIBRATION_SAMPLES; measured ++) {
+        calibration.misses += measure(1) >= calibration.threshold;
+    }
+    return calibration;
+}
+
+#ifndef CORE_CUSTOM_THRESHOLD
+
+// 90th percentile of self-probed cache hits plus a margin
+static uint64_t calculate_threshold(void) {
+    uint64_t vals[100];
+    warmup();
+    uint64_t trace = trace_begin();
+    for(uint32_t i = 0; i < 100; i++) {
+        vals[i] = probe(&vals[50]);
+        mfence();
+    }
+    qsort(vals, 100, sizeof(uint64_t), compare_int64);
+    trace_end(TRACE_CALIBRATION, trace);
+    return vals[90] + 40;
+}
+
+#endif /* CORE_CUSTOM_THRESHOLD */
+
+#endif /* CORE_H */
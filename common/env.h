@@ -0,0 +1,333 @@
+#ifndef ENV_H
+#define ENV_H
+
+// measurement environment manager shared by all harnesses.
+// env_setup() is called at the start of main and (best effort, nothing here is fatal):
+//  - locks its memory and optionally moves the process to SCHED_FIFO
+//  - checks whether IRQs, the tick (nohz_full) and the scheduler (isolcpus) leave the measurement core alone
+//  - reads (and optionally locks) governor and EPP of the measurement core
+//  - computes a noise score from canary probes and warns about (or migrates away from) noisy cores
+// all output goes to stderr, so it never mixes with results parsed from stdout. The last line,
+// "[env] metadata: core=<n> noise_ppm=<n> fifo=<prio>", is picked up by run_utils and stored with the results
+// (env_metadata() gives harnesses with their own output format the same text).
+//
+// configuration via environment variables:
+//   SL_ENV=0                 disable the environment manager
+//   SL_ENV_FIFO=<prio>       SCHED_FIFO priority, 0 keeps the current policy (default 0). Children (e.g. the process
+//                            victim) are reset to the normal policy, so they cannot starve the measurement core
+//   SL_ENV_MLOCK=0           do not mlockall
+//   SL_ENV_GOVERNOR=<gov>    lock scaling governor of the measurement core (restored at exit)
+//   SL_ENV_EPP=<pref>        lock energy performance preference of the measurement core (restored at exit)
+//   SL_ENV_CANARY_MS=<ms>    duration of the canary probes per core (default 20)
+//   SL_ENV_NOISE_MAX=<ppm>   noise score above which a core counts as noisy (default 1000)
+//   SL_ENV_MIGRATE=1         move to the quietest core of the affinity mask if the current one is noisy
+//   SL_ENV_MIGRATE=<cpus>    same, but among the given cpu list (e.g. "2-7"). Drivers pin every run to a single
+//                            core with taskset, which leaves no other core in the affinity mask to migrate to.
+//                            Not for victims on a sibling/other core fixed at compile time (THREAD_CORE)
+//
+// Harnesses whose core is chosen by their caller (the libstride_re worker, the collide_power attackers) define
+// ENV_FIXED_CORE before including env.h, SL_ENV_MIGRATE is ignored there.
+
+#ifndef _GNU_SOURCE
+    #error "env.h needs _GNU_SOURCE (sched_getcpu, cpu sets)"
+#endif /* _GNU_SOURCE */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+// a gap between two consecutive clock reads longer than this means the core was taken away from us
+#define ENV_CANARY_GAP_NS 2000
+
+#define ENV_MAX_CPUS 1024
+
+static int env_core = -1;
+
+// SCHED_FIFO priority, 0 if the policy was not changed
+static long env_fifo = 0;
+
+// fraction of the canary window (in ppm) that was lost to interrupts, preemption, etc.
+static double env_noise = 0;
+
+static char env_governor_saved[64];
+static char env_epp_saved[64];
+
+static long env_config(const char* name, long fallback) {
+    const char* value = getenv(name);
+    if(!value || !*value) {
+        return fallback;
+    }
+    return strtol(value, NULL, 0);
+}
+
+static int env_read_line(const char* path, char* line, size_t size) {
+    FILE* file = fopen(path, "r");
+    if(!file) {
+        return -1;
+    }
+    if(!fgets(line, size, file)) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    line[strcspn(line, "\n")] = 0;
+    return 0;
+}
+
+static int env_write_line(const char* path, const char* line) {
+    FILE* file = fopen(path, "w");
+    if(!file) {
+        return -1;
+    }
+    int failed = fputs(line, file) < 0;
+    return fclose(file) || failed ? -1 : 0;
+}
+
+// parses kernel cpu lists like "0-3,8,10-11"
+static int env_cpu_list_contains(const char* list, int cpu) {
+    const char* position = list;
+    while(*position) {
+        char* end;
+        long first = strtol(position, &end, 10);
+        if(end == position) {
+            break;
+        }
+        long last = first;
+        if(*end == '-') {
+            position = end + 1;
+            last = strtol(position, &end, 10);
+        }
+        if(cpu >= first && cpu <= last) {
+            return 1;
+        }
+        position = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+static int env_cpu_file_contains(const char* path, int cpu) {
+    char line[4096];
+    if(env_read_line(path, line, sizeof(line))) {
+        return 0;
+    }
+    return env_cpu_list_contains(line, cpu);
+}
+
+static uint64_t env_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// canary probe: spin on the clock for the canary window and sum up all gaps (time the core did not run us)
+static double env_canary(long duration_ms) {
+    uint64_t start = env_now_ns();
+    uint64_t end = start + duration_ms * 1000000ull;
+    uint64_t last = start, lost = 0, now;
+    while((now = env_now_ns()) < end) {
+        if(now - last > ENV_CANARY_GAP_NS) {
+            lost += now - last;
+        }
+        last = now;
+    }
+    return 1e6 * lost / (now - start);
+}
+
+static int env_pin(int cpu) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    return sched_setaffinity(0, sizeof(cpu_set_t), &cpuset);
+}
+
+// IRQs that may be delivered to the core (effective affinity if the kernel exposes it)
+static int env_count_irqs(int cpu) {
+    DIR* irqs = opendir("/proc/irq");
+    if(!irqs) {
+        return -1;
+    }
+    int count = 0;
+    struct dirent* irq;
+    while((irq = readdir(irqs))) {
+        if(irq->d_name[0] < '0' || irq->d_name[0] > '9') {
+            continue;
+        }
+        char path[300];
+        snprintf(path, sizeof(path), "/proc/irq/%s/effective_affinity_list", irq->d_name);
+        if(access(path, R_OK)) {
+            snprintf(path, sizeof(path), "/proc/irq/%s/smp_affinity_list", irq->d_name);
+        }
+        count += env_cpu_file_contains(path, cpu);
+    }
+    closedir(irqs);
+    return count;
+}
+
+static void env_restore_frequency(void) {
+    char path[128];
+    if(*env_governor_saved) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", env_core);
+        env_write_line(path, env_governor_saved);
+    }
+    if(*env_epp_saved) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/energy_performance_preference", env_core);
+        env_write_line(path, env_epp_saved);
+    }
+}
+
+static void env_frequency(int cpu) {
+    char path[128], governor[64] = "?", epp[64] = "?";
+    const char* lock_governor = getenv("SL_ENV_GOVERNOR");
+    const char* lock_epp = getenv("SL_ENV_EPP");
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+    if(!env_read_line(path, governor, sizeof(governor)) && lock_governor && strcmp(governor, lock_governor)) {
+        if(env_write_line(path, lock_governor)) {
+            fprintf(stderr, "[env] warning: failed to set governor %s on core %d\n", lock_governor, cpu);
+        } else {
+            strcpy(env_governor_saved, governor);
+            snprintf(governor, sizeof(governor), "%s", lock_governor);
+        }
+    }
+
+    // the EPP can only be changed with a non-performance governor on intel_pstate, so it comes second
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/energy_performance_preference", cpu);
+    if(!env_read_line(path, epp, sizeof(epp)) && lock_epp && strcmp(epp, lock_epp)) {
+        if(env_write_line(path, lock_epp)) {
+            fprintf(stderr, "[env] warning: failed to set EPP %s on core %d\n", lock_epp, cpu);
+        } else {
+            strcpy(env_epp_saved, epp);
+            snprintf(epp, sizeof(epp), "%s", lock_epp);
+        }
+    }
+
+    if(*env_governor_saved || *env_epp_saved) {
+        atexit(env_restore_frequency);
+    }
+    fprintf(stderr, "[env] core %d: governor %s, epp %s\n", cpu, governor, epp);
+    if(!lock_governor && strcmp(governor, "performance") && strcmp(governor, "?")) {
+        fprintf(stderr, "[env] warning: governor %s scales the frequency during measurements (SL_ENV_GOVERNOR=performance locks it)\n", governor);
+    }
+}
+
+// returns the measurement core
+static int env_setup(void) {
+    if(!env_config("SL_ENV", 1)) {
+        return sched_getcpu();
+    }
+
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(cpu_set_t), &allowed);
+    env_core = sched_getcpu();
+    if(CPU_COUNT(&allowed) > 1) {
+        fprintf(stderr, "[env] warning: not pinned to a single core (use taskset), pinning to core %d\n", env_core);
+    }
+
+    long priority = env_config("SL_ENV_FIFO", 0);
+    if(priority > 0) {
+        struct sched_param param = { .sched_priority = (int) priority };
+        if(sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &param)) {
+            fprintf(stderr, "[env] warning: failed to set SCHED_FIFO (not root?)\n");
+        } else {
+            env_fifo = priority;
+        }
+    }
+
+    // MCL_FUTURE lets later mappings fail if they exceed RLIMIT_MEMLOCK, so it needs an unlimited limit
+    if(env_config("SL_ENV_MLOCK", 1)) {
+        struct rlimit limit;
+        getrlimit(RLIMIT_MEMLOCK, &limit);
+        if(geteuid() && limit.rlim_cur != RLIM_INFINITY) {
+            fprintf(stderr, "[env] warning: RLIMIT_MEMLOCK is limited, not locking memory\n");
+        } else if(mlockall(MCL_CURRENT | MCL_FUTURE)) {
+            fprintf(stderr, "[env] warning: mlockall failed\n");
+        }
+    }
+
+    long canary_ms = env_config("SL_ENV_CANARY_MS", 20);
+    long noise_max = env_config("SL_ENV_NOISE_MAX", 1000);
+    env_noise = env_canary(canary_ms);
+
+    // migration candidates: the affinity mask for SL_ENV_MIGRATE=1, otherwise the given cpu list
+    const char* migrate = getenv("SL_ENV_MIGRATE");
+    #ifdef ENV_FIXED_CORE
+    if(migrate && *migrate && strcmp(migrate, "0")) {
+        fprintf(stderr, "[env] warning: SL_ENV_MIGRATE is ignored, core %d is fixed by the caller\n", env_core);
+    }
+    migrate = NULL;
+    #endif /* ENV_FIXED_CORE */
+    cpu_set_t candidates = allowed;
+    if(migrate && *migrate && strcmp(migrate, "0") && strcmp(migrate, "1")) {
+        CPU_ZERO(&candidates);
+        for(int cpu = 0; cpu < ENV_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+            if(env_cpu_list_contains(migrate, cpu)) {
+                CPU_SET(cpu, &candidates);
+            }
+        }
+    }
+    int migrating = migrate && *migrate && strcmp(migrate, "0");
+    if(migrating && CPU_COUNT(&candidates) < 2) {
+        fprintf(stderr, "[env] warning: SL_ENV_MIGRATE has no other core to migrate to (pass a cpu list under taskset)\n");
+    }
+
+    int pin = CPU_COUNT(&allowed) > 1;
+    if(env_noise > noise_max && migrating && CPU_COUNT(&candidates) > 1) {
+        int quietest = env_core;
+        double quietest_noise = env_noise;
+        for(int cpu = 0; cpu < ENV_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+            if(!CPU_ISSET(cpu, &candidates) || cpu == env_core || env_pin(cpu)) {
+                continue;
+            }
+            double noise = env_canary(canary_ms);
+            if(noise < quietest_noise) {
+                quietest = cpu;
+                quietest_noise = noise;
+            }
+        }
+        fprintf(stderr, "[env] core %d is noisy (%.0f ppm), migrating to core %d (%.0f ppm)\n", env_core, env_noise, quietest, quietest_noise);
+        env_core = quietest;
+        env_noise = quietest_noise;
+        pin = 1;
+    }
+    if(pin && env_pin(env_core)) {
+        fprintf(stderr, "[env] warning: failed to pin to core %d\n", env_core);
+    }
+
+    if(!env_cpu_file_contains("/sys/devices/system/cpu/isolated", env_core)) {
+        fprintf(stderr, "[env] warning: core %d is not isolated (isolcpus)\n", env_core);
+    }
+    if(!env_cpu_file_contains("/sys/devices/system/cpu/nohz_full", env_core)) {
+        fprintf(stderr, "[env] warning: core %d still gets the scheduler tick (nohz_full)\n", env_core);
+    }
+    int irqs = env_count_irqs(env_core);
+    if(irqs > 0) {
+        fprintf(stderr, "[env] warning: %d IRQs may be delivered to core %d\n", irqs, env_core);
+    }
+
+    env_frequency(env_core);
+
+    fprintf(stderr, "[env] core %d: noise score %.0f ppm%s\n", env_core, env_noise, env_noise > noise_max ? " (noisy!)" : "");
+    fprintf(stderr, "[env] metadata: core=%d noise_ppm=%.0f fifo=%ld\n", env_core, env_noise, env_fifo);
+    return env_core;
+}
+
+// noise score of the measurement core (ppm of time lost during the canary probes)
+static double env_noise_score(void) {
+    return env_noise;
+}
+
+// "env: core=<n> noise_ppm=<n> fifo=<prio>" for the metadata of result files (core -1 if env_setup() was disabled).
+// Fixed width (ENV_METADATA_SIZE - 1 characters), so a resumed file can rewrite it in place
+#define ENV_METADATA_SIZE 41
+static int env_metadata(char* buffer, size_t size) {
+    return snprintf(buffer, size, "env: core=%-4d noise_ppm=%-7.0f fifo=%-2ld", env_core, env_noise_score(), env_fifo);
+}
+
+#endif /* ENV_H */
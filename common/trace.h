@@ -0,0 +1,203 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// phase-level tracing of harness runs (C and C++).
+// Set SL_TRACE=<directory> and every process writes <directory>/trace_<pid>.json in the Chrome trace event format
+// at exit (load it in chrome://tracing or ui.perfetto.dev). tests/trace_utils.py records the Python driver in the
+// same time base and merges all files of a sweep into a single trace.
+//
+//   uint64_t start = trace_begin();
+//   ...
+//   trace_end(TRACE_FLUSH, start);
+//
+// Events are kept in per-thread buffers with raw TSC (CNTVCT on aarch64) timestamps, independent of the timer policy
+// of the measurement. They are converted to CLOCK_MONOTONIC microseconds only when the trace is written.
+// Without SL_TRACE, trace_begin / trace_end cost a single predictable branch. With it, every event is a store to the
+// trace buffer, which can disturb the prefetcher: use traces to see where wall-time goes, not for measurement results.
+
+#ifndef _GNU_SOURCE
+    #error "trace.h needs _GNU_SOURCE (program_invocation_short_name)"
+#endif /* _GNU_SOURCE */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+enum trace_phase {
+    TRACE_WARMUP,
+    TRACE_CALIBRATION,
+    TRACE_MAPPING,
+    TRACE_FLUSH,
+    TRACE_TRAIN,
+    TRACE_TRIGGER,
+    TRACE_PROBE,
+    TRACE_IO,
+    TRACE_PHASES
+};
+
+static const char* trace_phase_names[TRACE_PHASES] = {
+    "warm-up", "calibration", "mapping", "flush", "train", "trigger", "probe", "I/O"
+};
+
+// events per thread, later events are dropped (and counted)
+#ifndef TRACE_EVENTS
+    #define TRACE_EVENTS (1 << 18)
+#endif /* TRACE_EVENTS */
+
+struct trace_event {
+    uint64_t start;
+    uint64_t end;
+    uint64_t phase;
+};
+
+struct trace_buffer {
+    struct trace_buffer* next;
+    long tid;
+    uint64_t count;
+    uint64_t dropped;
+    struct trace_event events[TRACE_EVENTS];
+};
+
+// -1: not initialized yet, 0: disabled, 1: enabled
+static int trace_state = -1;
+static const char* trace_directory = NULL;
+static struct trace_buffer* trace_buffers = NULL;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct trace_buffer* trace_thread_buffer = NULL;
+
+// reference points to convert ticks to CLOCK_MONOTONIC
+static uint64_t trace_ticks_start, trace_ns_start;
+
+static inline __attribute__((always_inline)) uint64_t trace_ticks(void) {
+    #if defined(__x86_64__)
+        uint64_t a, d;
+        asm volatile("rdtsc" : "=a" (a), "=d" (d));
+        return (d << 32) | a;
+    #elif defined(__aarch64__)
+        uint64_t a;
+        asm volatile("mrs %0, CNTVCT_EL0" : "=r" (a));
+        return a;
+    #else
+        #error "unknown architecture. Only x86_64 and aarch64 are supported"
+    #endif
+}
+
+static uint64_t trace_monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void trace_write(void) {
+    uint64_t ticks_end = trace_ticks();
+    uint64_t ns_end = trace_monotonic_ns();
+    double ns_per_tick = ticks_end > trace_ticks_start ? (double) (ns_end - trace_ns_start) / (ticks_end - trace_ticks_start) : 1;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/trace_%d.json", trace_directory, (int) getpid());
+    FILE* file = fopen(path, "w");
+    if(!file) {
+        fprintf(stderr, "[trace] failed to write %s\n", path);
+        return;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}}", (int) getpid(), program_invocation_short_name);
+    for(struct trace_buffer* buffer = trace_buffers; buffer; buffer = buffer->next) {
+        uint64_t count = __atomic_load_n(&buffer->count, __ATOMIC_ACQUIRE);
+        for(uint64_t i = 0; i < count; i++) {
+            struct trace_event* event = &buffer->events[i];
+            double start = (trace_ns_start + ((double) event->start - trace_ticks_start) * ns_per_tick) / 1000;
+            double duration = (event->end - event->start) * ns_per_tick / 1000;
+            fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"harness\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %ld}",
+                trace_phase_names[event->phase], start, duration, (int) getpid(), buffer->tid);
+        }
+        if(buffer->dropped) {
+            fprintf(stderr, "[trace] thread %ld dropped %zu events (TRACE_EVENTS)\n", buffer->tid, (size_t) buffer->dropped);
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
+
+static int trace_init(void) {
+    trace_directory = getenv("SL_TRACE");
+    trace_state = trace_directory && *trace_directory;
+    if(trace_state) {
+        trace_ticks_start = trace_ticks();
+        trace_ns_start = trace_monotonic_ns();
+        atexit(trace_write);
+    }
+    return trace_state;
+}
+
+static struct trace_buffer* trace_thread(void) {
+    if(!trace_thread_buffer) {
+        struct trace_buffer* buffer = (struct trace_buffer*) calloc(1, sizeof(struct trace_buffer));
+        if(!buffer) {
+            return NULL;
+        }
+        buffer->tid = syscall(SYS_gettid);
+        pthread_mutex_lock(&trace_lock);
+        buffer->next = trace_buffers;
+        trace_buffers = buffer;
+        pthread_mutex_unlock(&trace_lock);
+        trace_thread_buffer = buffer;
+    }
+    return trace_thread_buffer;
+}
+
+static inline __attribute__((always_inline)) uint64_t trace_begin(void) {
+    if(__builtin_expect(trace_state == 0, 1)) {
+        return 0;
+    }
+    if(trace_state < 0 && !trace_init()) {
+        return 0;
+    }
+    return trace_ticks();
+}
+
+static inline __attribute__((always_inline)) void trace_end(enum trace_phase phase, uint64_t start) {
+    if(__builtin_expect(trace_state <= 0 || !start, 1)) {
+        return;
+    }
+    uint64_t end = trace_ticks();
+    struct trace_buffer* buffer = trace_thread();
+    if(!buffer) {
+        return;
+    }
+    if(buffer->count == TRACE_EVENTS) {
+        buffer->dropped ++;
+        return;
+    }
+    struct trace_event* event = &buffer->events[buffer->count];
+    event->start = start;
+    event->end = end;
+    event->phase = phase;
+    __atomic_store_n(&buffer->count, buffer->count + 1, __ATOMIC_RELEASE);
+}
+
+// The training rounds of the stride tests run while the prefetcher is trained, so by default they get a single "train"
+// event around all rounds and no trace point inside. -DTRACE_ROUNDS splits them into train / trigger events per round
+// instead (a branch between the training accesses and the trigger, and a store with SL_TRACE).
+#ifdef TRACE_ROUNDS
+    #define trace_rounds_begin() 0
+    #define trace_rounds_end(start) ((void) (start))
+    #define trace_round_begin() trace_begin()
+    #define trace_round_end(phase, start) trace_end(phase, start)
+#else
+    #define trace_rounds_begin() trace_begin()
+    #define trace_rounds_end(start) trace_end(TRACE_TRAIN, start)
+    #define trace_round_begin() 0
+    #define trace_round_end(phase, start) ((void) (start))
+#endif /* TRACE_ROUNDS */
+
+#endif /* TRACE_H */
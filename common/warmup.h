@@ -0,0 +1,160 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+// frequency-settle detector, replaces the fixed nop loops that were supposed to bring the processor into steady state.
+// warmup() keeps the core busy with a dependency chain and samples the effective frequency, either from APERF
+// (perf msr PMU, needs perf permissions) or from the chain itself (one add per cycle) against the clock.
+// It stops as soon as the frequency stayed within WARMUP_TOLERANCE for WARMUP_WINDOW samples, but never spins longer
+// than WARMUP_MAX_MS. The settled frequency is reported on stderr, followed by
+// "[warmup] metadata: mhz=<n> settled=<0|1> source=<aperf|chain>", which run_utils stores with the results.
+
+#ifndef _GNU_SOURCE
+    #error "warmup.h needs _GNU_SOURCE (sched_getcpu)"
+#endif /* _GNU_SOURCE */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "trace.h"
+
+// duration of a single frequency sample
+#ifndef WARMUP_SAMPLE_US
+    #define WARMUP_SAMPLE_US 1000
+#endif /* WARMUP_SAMPLE_US */
+
+// number of consecutive samples that have to agree
+#ifndef WARMUP_WINDOW
+    #define WARMUP_WINDOW 20
+#endif /* WARMUP_WINDOW */
+
+// maximum relative (interquartile) spread of the samples in the window
+#ifndef WARMUP_TOLERANCE
+    #define WARMUP_TOLERANCE 0.01
+#endif /* WARMUP_TOLERANCE */
+
+// upper bound for the warm-up, the frequency is reported as unsettled afterwards
+#ifndef WARMUP_MAX_MS
+    #define WARMUP_MAX_MS 3000
+#endif /* WARMUP_MAX_MS */
+
+// settled frequency in MHz (0 until warmup() ran)
+static double warmup_mhz = 0;
+
+static uint64_t warmup_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// serially dependent adds, one per cycle on every core we care about.
+// register operands on purpose: recent Intel cores fold chains of add-immediate at rename (several per cycle)
+static inline __attribute__((always_inline)) void warmup_chain(uint64_t iterations) {
+    uint64_t value = 0, one = 1;
+    for(uint64_t i = 0; i < iterations; i += 8) {
+        #if defined(__x86_64__)
+            asm volatile(".rept 8\nadd %1, %0\n.endr" : "+r" (value) : "r" (one));
+        #elif defined(__aarch64__)
+            asm volatile(".rept 8\nadd %0, %0, %1\n.endr" : "+r" (value) : "r" (one));
+        #else
+            #error "unknown architecture. Only x86_64 and aarch64 are supported"
+        #endif
+    }
+}
+
+// APERF of the current core via the perf msr PMU (-1 if not available)
+static int warmup_open_aperf(void) {
+    char line[64];
+    FILE* file = fopen("/sys/bus/event_source/devices/msr/type", "r");
+    if(!file) {
+        return -1;
+    }
+    int type = fgets(line, sizeof(line), file) ? atoi(line) : -1;
+    fclose(file);
+
+    file = fopen("/sys/bus/event_source/devices/msr/events/aperf", "r");
+    if(!file) {
+        return -1;
+    }
+    const char* config = fgets(line, sizeof(line), file) ? strstr(line, "event=") : NULL;
+    fclose(file);
+    if(type < 0 || !config) {
+        return -1;
+    }
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = type;
+    attr.size = sizeof(attr);
+    attr.config = strtoull(config + strlen("event="), NULL, 0);
+    // the msr PMU only supports per-cpu events
+    return syscall(SYS_perf_event_open, &attr, -1, sched_getcpu(), -1, 0);
+}
+
+static uint64_t warmup_read(int fd) {
+    uint64_t value = 0;
+    if(read(fd, &value, sizeof(value)) != sizeof(value)) {
+        return 0;
+    }
+    return value;
+}
+
+static int warmup_compare(const void* a, const void* b) {
+    double difference = *(const double*) a - *(const double*) b;
+    return (difference > 0) - (difference < 0);
+}
+
+// returns the settled frequency in MHz
+static double warmup(void) {
+    uint64_t trace = trace_begin();
+    int aperf = warmup_open_aperf();
+    double samples[WARMUP_WINDOW];
+    uint64_t iterations = 1000000;
+    uint64_t start = warmup_now_ns();
+    int settled = 0;
+
+    for(uint64_t taken = 0; warmup_now_ns() - start < WARMUP_MAX_MS * 1000000ull; taken ++) {
+        uint64_t cycles = aperf >= 0 ? warmup_read(aperf) : 0;
+        uint64_t begin = warmup_now_ns();
+        warmup_chain(iterations);
+        uint64_t end = warmup_now_ns();
+        cycles = aperf >= 0 ? warmup_read(aperf) - cycles : iterations;
+
+        double mhz = (double) cycles * 1000 / (end - begin);
+        samples[taken % WARMUP_WINDOW] = mhz;
+        // aim for one sample per WARMUP_SAMPLE_US at the current frequency
+        iterations = (uint64_t) (mhz * WARMUP_SAMPLE_US) & ~7ull;
+        if(iterations < 8) {
+            iterations = 8;
+        }
+
+        if(taken + 1 < WARMUP_WINDOW) {
+            continue;
+        }
+        // interquartile spread, so single samples hit by an interrupt do not restart the window
+        double sorted[WARMUP_WINDOW];
+        memcpy(sorted, samples, sizeof(sorted));
+        qsort(sorted, WARMUP_WINDOW, sizeof(double), warmup_compare);
+        warmup_mhz = sorted[WARMUP_WINDOW / 2];
+        if(sorted[WARMUP_WINDOW * 3 / 4] - sorted[WARMUP_WINDOW / 4] <= WARMUP_TOLERANCE * warmup_mhz) {
+            settled = 1;
+            break;
+        }
+    }
+
+    if(aperf >= 0) {
+        close(aperf);
+    }
+    trace_end(TRACE_WARMUP, trace);
+    fprintf(stderr, "[warmup] %s at %.0f MHz after %.0f ms (%s)\n", settled ? "settled" : "NOT settled", warmup_mhz, (warmup_now_ns() - start) / 1e6, aperf >= 0 ? "aperf" : "dependency chain");
+    fprintf(stderr, "[warmup] metadata: mhz=%.0f settled=%d source=%s\n", warmup_mhz, settled, aperf >= 0 ? "aperf" : "chain");
+    return warmup_mhz;
+}
+
+#endif /* WARMUP_H */